@@ -1,22 +1,20 @@
-#include "connection.h"
 #include "skynet.h"
+#include "skynet_socket.h"
 
-
-#include <sys/types.h>
-#include <sys/socket.h>
-
-#include <unistd.h>
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
-#define DEFAULT_BUFFER_SIZE 1024
+// The fds opened by lua services (see lualib/socket.lua) are polled by socket thread , connection
+// forwards the data to the owner as PTYPE_CLIENT , and an empty message for close.
+
 #define DEFAULT_CONNECTION 16
 
 struct connection {
 	int fd;
+	int id;	// socket id
 	uint32_t address;
 	int close;
 };
@@ -24,7 +22,6 @@ struct connection {
 struct connection_server {
 	int max_connection;
 	int current_connection;
-	struct connection_pool *pool;
 	struct skynet_context *ctx;
 	struct connection * conn;
 };
@@ -38,24 +35,16 @@ connection_create(void) {
 
 void
 connection_release(struct connection_server * server) {
-	if (server->pool) {
-		connection_deletepool(server->pool);
-	}
 	free(server->conn);
 	free(server);
 }
 
 static void
 _expand(struct connection_server * server) {
-	connection_deletepool(server->pool);
-	server->pool = connection_newpool(server->max_connection * 2);
-	int i;
-	for (i=0;i<server->max_connection;i++) {
-		struct connection * c = &server->conn[i];
-		int err = connection_add(server->pool, c->fd , c);
-		assert(err == 0);
-	}
-	server->max_connection *= 2;
+	int n = server->max_connection;
+	server->conn = realloc(server->conn, n * 2 * sizeof(struct connection));
+	memset(server->conn + n, 0, n * sizeof(struct connection));
+	server->max_connection = n * 2;
 }
 
 static void
@@ -68,32 +57,55 @@ _add(struct connection_server * server, int fd , uint32_t address) {
 	for (i=0;i<server->max_connection;i++) {
 		struct connection * c = &server->conn[i];
 		if (c->address == 0) {
+			int id = skynet_socket_bind(server->ctx, fd);
+			if (id < 0) {
+				skynet_error(server->ctx, "[connection] Bind fd %d failed", fd);
+				--server->current_connection;
+				return;
+			}
 			c->fd = fd;
+			c->id = id;
 			c->address = address;
 			c->close = 0;
-			int err = connection_add(server->pool, fd , c);
-			assert(err == 0);
 			return;
 		}
 	}
 	assert(0);
 }
 
+static struct connection *
+_find(struct connection_server * server, int id) {
+	int i;
+	for (i=0;i<server->max_connection;i++) {
+		struct connection * c = &server->conn[i];
+		if (c->address && c->id == id) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+static void
+_remove(struct connection_server * server, struct connection *c) {
+	--server->current_connection;
+	c->address = 0;
+	c->fd = 0;
+	c->id = 0;
+	c->close = 0;
+}
+
 static void
 _del(struct connection_server * server, int fd) {
 	int i;
 	for (i=0;i<server->max_connection;i++) {
 		struct connection * c = &server->conn[i];
-		if (c->fd == fd) {
+		if (c->address && c->fd == fd) {
 			if (c->close == 0) {
 				skynet_send(server->ctx, 0, c->address, PTYPE_CLIENT | PTYPE_TAG_DONTCOPY, 0, NULL, 0);
-				connection_del(server->pool, fd);
 			}
-			--server->current_connection;
-			c->address = 0;
-			c->fd = 0;
-			c->close = 0;
-			close(fd);
+			// socket thread closes the fd
+			skynet_socket_close(server->ctx, c->id);
+			_remove(server, c);
 			return;
 		}
 	}
@@ -102,44 +114,31 @@ _del(struct connection_server * server, int fd) {
 }
 
 static void
-_poll(struct connection_server * server) {
-	int timeout = 100;
-	void * buffer = NULL;
-	for (;;) {
-		struct connection * c = connection_poll(server->pool, timeout);
-		if (c==NULL) {
-			skynet_command(server->ctx,"TIMEOUT","1");
-			return;
-		}
-		timeout = 0;
-
-		if (buffer == NULL) {
-			buffer = malloc(DEFAULT_BUFFER_SIZE);
-		}
-
-		int size = read(c->fd, buffer, DEFAULT_BUFFER_SIZE);
-		if (size < 0) {
-			continue;
-		}
-		if (size == 0) {
-			free(buffer);
-			buffer = NULL;
-			if (c->close == 0) {
-				c->close = 1;
-				skynet_send(server->ctx, 0, c->address, PTYPE_CLIENT | PTYPE_TAG_DONTCOPY, 0, NULL, 0);
-				connection_del(server->pool, c->fd);
-			}
+_socket_message(struct connection_server * server, const struct skynet_socket_message * message) {
+	struct connection * c = _find(server, message->id);
+	switch (message->type) {
+	case SKYNET_SOCKET_TYPE_DATA:
+		if (c) {
+			skynet_send(server->ctx, 0, c->address, PTYPE_CLIENT | PTYPE_TAG_DONTCOPY, 0, message->buffer, message->ud);
 		} else {
-			skynet_send(server->ctx, 0, c->address, PTYPE_CLIENT | PTYPE_TAG_DONTCOPY, 0, buffer, size);
-			buffer = NULL;
+			skynet_free(message->buffer);
 		}
+		break;
+	case SKYNET_SOCKET_TYPE_CLOSE:
+	case SKYNET_SOCKET_TYPE_ERROR:
+		// the owner still holds the fd , it's closed by DEL
+		if (c && c->close == 0) {
+			c->close = 1;
+			skynet_send(server->ctx, 0, c->address, PTYPE_CLIENT | PTYPE_TAG_DONTCOPY, 0, NULL, 0);
+		}
+		break;
 	}
 }
 
 static int
 _connection_main(struct skynet_context * ctx, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
-	if (type == PTYPE_RESPONSE) {
-		_poll(ud);
+	if (type == PTYPE_SOCKET) {
+		_socket_message(ud, msg);
 		return 0;
 	}
 	assert(type == PTYPE_TEXT);
@@ -182,9 +181,6 @@ _connection_main(struct skynet_context * ctx, void * ud, int type, int session,
 
 int
 connection_init(struct connection_server * server, struct skynet_context * ctx, char * param) {
-	server->pool = connection_newpool(DEFAULT_CONNECTION);
-	if (server->pool == NULL)
-		return 1;
 	server->max_connection = strtol(param, NULL, 10);
 	if (server->max_connection == 0) {
 		server->max_connection = DEFAULT_CONNECTION;
@@ -196,9 +192,5 @@ connection_init(struct connection_server * server, struct skynet_context * ctx,
 
 	skynet_callback(ctx, server, _connection_main);
 	skynet_command(ctx,"REG",".connection");
-	skynet_command(ctx,"TIMEOUT","0");
 	return 0;
 }
-
-
-
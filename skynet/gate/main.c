@@ -1,9 +1,7 @@
 #include "skynet.h"
-#include "mread.h"
+#include "skynet_socket.h"
+#include "hashid.h"
 
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -11,36 +9,84 @@
 #include <stdio.h>
 #include <stdarg.h>
 
+#define BACKLOG 1024
+// max size of a message , see HANDLE_MASK
+#define MAX_PACKAGE 0xffffff
+
 struct connection {
+	int id;	// socket id , it's also the id reported to watchdog
 	uint32_t agent;
 	uint32_t client;
-	int connection_id;
-	int uid;
+	int paused;
+	char remote_name[32];
+	// the unfinished package : the header , then the payload allocated once the length is known ,
+	// so a package across reads is copied only once
+	uint8_t header[4];
+	int header_read;
+	char * pack;
+	int pack_size;
+	int pack_len;
 };
 
 struct gate {
-	struct mread_pool * pool;
+	struct skynet_context *ctx;
+	int listen_id;
 	uint32_t watchdog;
 	uint32_t broker;
-	int id_index;
-	int cap;
-	int max_connection;
 	int client_tag;
 	int header_size;
-	struct connection ** agent;
-	struct connection * map;
+	int max_connection;
+	// max bytes of an unfinished package , 0 for no limit
+	int max_buffer;
+	// max bytes waiting to be sent to a client , the slow one is kicked. 0 for no limit
+	int max_send;
+	// write the packages of one tick together , see socket_server_cork
+	int cork;
+	// forward packages as slices of the socket buffer without copy , see skynet_send_slice
+	int slice;
+	// the service whose mailbox is full , connections forwarding to it are paused until it recovers
+	uint32_t block;
+	// metrics of this gate (one shard when the port is shared) , see "stat" command
+	struct {
+		uint64_t accept;
+		uint64_t reject;
+		uint64_t close;
+		uint64_t in_package;
+		uint64_t in_bytes;
+		uint64_t out_package;
+		uint64_t out_bytes;
+		uint64_t alloc;	// messages allocated for packages
+		uint64_t copy;	// bytes of packages copied
+	} stat;
+	struct hashid hash;
+	struct connection *conn;
 };
 
 struct gate *
 gate_create(void) {
 	struct gate * g = malloc(sizeof(*g));
 	memset(g,0,sizeof(*g));
+	g->listen_id = -1;
 	return g;
 }
 
-static inline struct connection * 
-_id_to_agent(struct gate *g,int uid) {
-	return g->agent[uid & (g->cap - 1)];
+void
+gate_release(struct gate *g) {
+	int i;
+	struct skynet_context *ctx = g->ctx;
+	for (i=0;i<g->max_connection;i++) {
+		struct connection *c = &g->conn[i];
+		if (c->id >= 0) {
+			skynet_socket_close(ctx, c->id);
+		}
+		skynet_free(c->pack);
+	}
+	if (g->listen_id >= 0) {
+		skynet_socket_close(ctx, g->listen_id);
+	}
+	hashid_clear(&g->hash);
+	free(g->conn);
+	free(g);
 }
 
 static void
@@ -59,15 +105,37 @@ _parm(char *msg, int sz, int command_sz) {
 
 static void
 _forward_agent(struct gate * g, int id, uint32_t agentaddr, uint32_t clientaddr) {
-	struct connection * agent = _id_to_agent(g,id);
-	if (agent) {
+	int idx = hashid_lookup(&g->hash, id);
+	if (idx >= 0) {
+		struct connection * agent = &g->conn[idx];
 		agent->agent = agentaddr;
 		agent->client = clientaddr;
 	}
 }
 
 static void
-_ctrl(struct skynet_context * ctx, struct gate * g, const void * msg, int sz) {
+_stat(struct skynet_context * ctx, struct gate * g, uint32_t source, int session) {
+	char tmp[256];
+	int n = snprintf(tmp, sizeof(tmp), "connection %d accept %llu reject %llu close %llu in %llu %llu out %llu %llu alloc %llu copy %llu",
+		g->hash.count,
+		(unsigned long long)g->stat.accept,
+		(unsigned long long)g->stat.reject,
+		(unsigned long long)g->stat.close,
+		(unsigned long long)g->stat.in_package,
+		(unsigned long long)g->stat.in_bytes,
+		(unsigned long long)g->stat.out_package,
+		(unsigned long long)g->stat.out_bytes,
+		(unsigned long long)g->stat.alloc,
+		(unsigned long long)g->stat.copy);
+	if (session == 0) {
+		skynet_error(ctx, "[gate] %s", tmp);
+	} else {
+		skynet_send(ctx, 0, source, PTYPE_RESPONSE, session, tmp, n);
+	}
+}
+
+static void
+_ctrl(struct skynet_context * ctx, struct gate * g, uint32_t source, int session, const void * msg, int sz) {
 	char tmp[sz+1];
 	memcpy(tmp, msg, sz);
 	tmp[sz] = '\0';
@@ -83,10 +151,10 @@ _ctrl(struct skynet_context * ctx, struct gate * g, const void * msg, int sz) {
 	if (memcmp(command,"kick",i)==0) {
 		_parm(tmp, sz, i);
 		int uid = strtol(command , NULL, 10);
-		struct connection * agent = _id_to_agent(g,uid);
-		if (agent) {
-			int connection_id = agent->connection_id;
-			mread_close_client(g->pool,connection_id);
+		int idx = hashid_lookup(&g->hash, uid);
+		if (idx >= 0) {
+			// the connection is removed when socket thread reports close
+			skynet_socket_close(ctx, uid);
 		}
 		return;
 	}
@@ -113,7 +181,11 @@ _ctrl(struct skynet_context * ctx, struct gate * g, const void * msg, int sz) {
 		return;
 	}
 	if (memcmp(command,"start",i) == 0) {
-		skynet_command(ctx,"TIMEOUT","0");
+		skynet_socket_start(ctx, g->listen_id);
+		return;
+	}
+	if (memcmp(command,"stat",i) == 0) {
+		_stat(ctx, g, source, session);
 		return;
 	}
 	skynet_error(ctx, "[gate] Unkown command : %s", command);
@@ -133,125 +205,288 @@ _report(struct gate *g, struct skynet_context * ctx, const char * data, ...) {
 	skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT,  0, tmp, n);
 }
 
+// data is inside block (the receiver gets a slice of it) , or copied if block is NULL
+static void
+_send_client(struct skynet_context * ctx, struct gate *g, struct connection *c, uint32_t source, uint32_t destination, void * block, void * data, size_t len) {
+	if (block) {
+		skynet_send_slice(ctx, source, destination, g->client_tag, 0, block, data, len);
+	} else {
+		++g->stat.alloc;
+		g->stat.copy += len;
+		skynet_send(ctx, source, destination, g->client_tag, 0, data, len);
+	}
+	if (skynet_overload(destination)) {
+		// leave the data in kernel buffer , tcp flow control slows down the client
+		if (!c->paused) {
+			c->paused = 1;
+			skynet_socket_pause(ctx, c->id);
+		}
+		if (g->block == 0) {
+			skynet_timeout_session(ctx, 1);
+		}
+		g->block = destination;
+	}
+}
+
 static void
-_forward(struct skynet_context * ctx,struct gate *g, int uid, void * data, size_t len) {
+_forward(struct skynet_context * ctx,struct gate *g, struct connection *c, void * block, void * data, size_t len) {
 	if (g->broker) {
-		skynet_send(ctx, 0, g->broker, g->client_tag, 0, data, len);
+		_send_client(ctx, g, c, 0, g->broker, block, data, len);
 		return;
 	}
-	struct connection * agent = _id_to_agent(g,uid);
-	if (agent == NULL)
-		return;
-	if (agent->agent) {
-		skynet_send(ctx, agent->client, agent->agent, g->client_tag, 0 , data, len);
+	if (c->agent) {
+		_send_client(ctx, g, c, c->client, c->agent, block, data, len);
 	} else if (g->watchdog) {
-		char * tmp = malloc(len + 32);
-		int n = snprintf(tmp,len+32,"%d data ",uid);
+		++g->stat.alloc;
+		g->stat.copy += len;
+		char * tmp = skynet_malloc(len + 32);
+		int n = snprintf(tmp,len+32,"%d data ",c->id);
 		memcpy(tmp+n,data,len);
 		skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT | PTYPE_TAG_DONTCOPY, 0, tmp, len + n);
 	}
 }
 
+static uint32_t
+_length(struct gate *g, const uint8_t * plen) {
+	// big-endian
+	if (g->header_size == 2) {
+		return plen[0] << 8 | plen[1];
+	} else {
+		return (uint32_t)plen[0] << 24 | plen[1] << 16 | plen[2] << 8 | plen[3];
+	}
+}
+
+static void
+_reset(struct connection *c) {
+	skynet_free(c->pack);
+	c->pack = NULL;
+	c->header_read = 0;
+	c->pack_size = 0;
+	c->pack_len = 0;
+}
+
+// the length in header comes from client , close the connection if it's too large
 static int
-_gen_id(struct gate * g, int connection_id) {
-	int uid = ++g->id_index;
-	int i;
-	for (i=0;i<g->cap;i++) {
-		int hash = (uid + i) & (g->cap - 1);
-		if (g->agent[hash] == NULL) {
-			uid = uid + i;
-			struct connection * conn = &g->map[connection_id];
-			conn->uid = uid;
-			g->agent[hash] = conn;
-			g->id_index = uid;
-			return uid;
+_toolarge(struct skynet_context * ctx, struct gate *g, struct connection *c, uint32_t len) {
+	if (len > MAX_PACKAGE || (g->max_buffer > 0 && len > (uint32_t)g->max_buffer)) {
+		skynet_error(ctx, "Connection %d package is too large (%u bytes)", c->id, len);
+		_reset(c);
+		skynet_socket_close(ctx, c->id);
+		return 1;
+	}
+	return 0;
+}
+
+// forward the complete packages in p (inside block , or NULL for copy) , return the bytes used
+static int
+_forward_package(struct skynet_context * ctx, struct gate *g, struct connection *c, void * block, const uint8_t * p, int sz) {
+	int header_size = g->header_size;
+	int offset = 0;
+	while (sz - offset >= header_size) {
+		const uint8_t * plen = p + offset;
+		uint32_t len = _length(g, plen);
+		if (_toolarge(ctx, g, c, len)) {
+			return sz;
+		}
+		if (sz - offset - header_size < (int)len) {
+			break;
+		}
+		_forward(ctx, g, c, block, (void *)(plen + header_size), len);
+		offset += header_size + len;
+		++g->stat.in_package;
+	}
+	return offset;
+}
+
+// read the unfinished package from data , forward it if it's complete. return the bytes used
+static int
+_fill(struct skynet_context * ctx, struct gate *g, struct connection *c, const char * data, int sz) {
+	int offset = 0;
+	if (c->header_read < g->header_size) {
+		int n = g->header_size - c->header_read;
+		if (n > sz) {
+			n = sz;
+		}
+		memcpy(c->header + c->header_read, data, n);
+		c->header_read += n;
+		offset = n;
+		if (c->header_read < g->header_size) {
+			return offset;
 		}
+		uint32_t len = _length(g, c->header);
+		if (_toolarge(ctx, g, c, len)) {
+			return sz;
+		}
+		++g->stat.alloc;
+		c->pack = skynet_malloc(len);
+		c->pack_len = len;
+		c->pack_size = 0;
+	}
+	int n = c->pack_len - c->pack_size;
+	if (n > sz - offset) {
+		n = sz - offset;
+	}
+	memcpy(c->pack + c->pack_size, data + offset, n);
+	c->pack_size += n;
+	offset += n;
+	g->stat.copy += n;
+	if (c->pack_size == c->pack_len) {
+		++g->stat.in_package;
+		_forward(ctx, g, c, c->pack, c->pack, c->pack_len);
+		// release the reference of gate , the receiver holds another one
+		_reset(c);
 	}
-	assert(0);
+	return offset;
 }
 
+// data is in block (the socket buffer) , the complete packages are forwarded from it directly
 static void
-_remove_id(struct gate *g, int uid) {
-	struct connection ** pconn = &g->agent[uid & (g->cap - 1)];
-	struct connection * conn = *pconn;
-	if (conn) {
-		assert(conn->uid == uid);
-		conn->uid = 0;
-		conn->agent = 0;
-		*pconn = NULL;
+_read_data(struct skynet_context * ctx, struct gate *g, struct connection *c, void * block, const char * data, int sz) {
+	int offset = 0;
+	if (c->header_read > 0) {
+		offset = _fill(ctx, g, c, data, sz);
+	}
+	if (offset < sz) {
+		offset += _forward_package(ctx, g, c, g->slice ? block : NULL, (const uint8_t *)data + offset, sz - offset);
+		if (offset < sz) {
+			_fill(ctx, g, c, data + offset, sz - offset);
+		}
+	}
+}
+
+static void
+_close(struct skynet_context * ctx, struct gate *g, int id) {
+	int idx = hashid_remove(&g->hash, id);
+	if (idx >= 0) {
+		struct connection *c = &g->conn[idx];
+		c->id = -1;
+		c->agent = 0;
+		c->client = 0;
+		c->paused = 0;
+		_reset(c);
+		++g->stat.close;
+		_report(g, ctx, "%d close", id);
+	} else if (id == g->listen_id) {
+		skynet_error(ctx, "[gate] Listen socket closed");
+		g->listen_id = -1;
+	}
+}
+
+static void
+_socket_message(struct skynet_context * ctx, struct gate *g, const struct skynet_socket_message * message, int sz) {
+	switch(message->type) {
+	case SKYNET_SOCKET_TYPE_DATA: {
+		int idx = hashid_lookup(&g->hash, message->id);
+		if (idx >= 0) {
+			g->stat.in_bytes += message->ud;
+			_read_data(ctx, g, &g->conn[idx], message->buffer, message->buffer, message->ud);
+		} else {
+			skynet_error(ctx, "Drop unknown connection %d message", message->id);
+			skynet_socket_close(ctx, message->id);
+		}
+		skynet_free(message->buffer);
+		break;
+	}
+	case SKYNET_SOCKET_TYPE_CONNECT: {
+		if (message->id == g->listen_id) {
+			// start listening
+			break;
+		}
+		int idx = hashid_lookup(&g->hash, message->id);
+		if (idx < 0) {
+			skynet_error(ctx, "Close unknown connection %d", message->id);
+			skynet_socket_close(ctx, message->id);
+		} else {
+			struct connection *c = &g->conn[idx];
+			_report(g, ctx, "%d open %d %s", c->id, c->id, c->remote_name);
+		}
+		break;
+	}
+	case SKYNET_SOCKET_TYPE_CLOSE:
+	case SKYNET_SOCKET_TYPE_ERROR:
+		_close(ctx, g, message->id);
+		break;
+	case SKYNET_SOCKET_TYPE_ACCEPT:
+		// report by socket thread , the connection is opened after start
+		assert(g->listen_id == message->id);
+		if (hashid_full(&g->hash)) {
+			++g->stat.reject;
+			skynet_socket_close(ctx, message->ud);
+		} else {
+			++g->stat.accept;
+			struct connection *c = &g->conn[hashid_insert(&g->hash, message->ud)];
+			int len = sz - (int)sizeof(*message);
+			if (len >= (int)sizeof(c->remote_name)) {
+				len = sizeof(c->remote_name) - 1;
+			}
+			c->id = message->ud;
+			memcpy(c->remote_name, message+1, len);
+			c->remote_name[len] = '\0';
+			if (g->max_send > 0) {
+				skynet_socket_limit(ctx, message->ud, g->max_send);
+			}
+			if (g->cork) {
+				skynet_socket_cork(ctx, message->ud, 1);
+			}
+			skynet_socket_start(ctx, message->ud);
+		}
+		break;
+	}
+}
+
+static void
+_resume(struct skynet_context * ctx, struct gate *g) {
+	int i;
+	for (i=0;i<g->max_connection;i++) {
+		struct connection *c = &g->conn[i];
+		if (c->id >= 0 && c->paused) {
+			c->paused = 0;
+			skynet_socket_start(ctx, c->id);
+		}
 	}
 }
 
 static int
 _cb(struct skynet_context * ctx, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
 	struct gate *g = ud;
-	if (type == PTYPE_TEXT) {
-		_ctrl(ctx, g , msg , (int)sz);
-		return 0;
-	} else if (type == PTYPE_CLIENT) {
+	switch(type) {
+	case PTYPE_TEXT:
+		_ctrl(ctx, g , source, session, msg , (int)sz);
+		break;
+	case PTYPE_CLIENT: {
 		if (sz <=4 ) {
 			skynet_error(ctx, "Invalid client message from %x",source);
-			return 0;
+			break;
 		}
-		struct mread_pool * m = g->pool;
 		// The first 4 bytes in msg are the id of socket, write following bytes to it
 		const uint8_t * data = msg;
 		uint32_t uid = data[0] | data[1] << 8 | data[2] << 16 | data[3] << 24;
-		struct connection * agent = _id_to_agent(g,uid);
-		if (agent) {
-			int id = agent->connection_id;
-			mread_push(m, id, (void *)(data+4), sz - 4, (void *)data);
-			return 1;
+		int idx = hashid_lookup(&g->hash, uid);
+		if (idx >= 0) {
+			// msg may be shared (multicast) , hold a reference and send it without copy
+			skynet_ref((void *)msg, 1);
+			++g->stat.out_package;
+			g->stat.out_bytes += sz - 4;
+			skynet_socket_send_slice(ctx, uid, (void *)msg, 4, sz - 4);
 		} else {
 			skynet_error(ctx, "Invalid client id %d from %x",(int)uid,source);
-			return 0;
 		}
+		break;
 	}
-
-	assert(type == PTYPE_RESPONSE);
-	struct mread_pool * m = g->pool;
-	int connection_id = mread_poll(m,100);	// timeout : 100ms
-	if (connection_id < 0) {
-		skynet_command(ctx, "TIMEOUT", "1");
-	} else {
-		int id = g->map[connection_id].uid;
-		if (id == 0) {
-			id = _gen_id(g, connection_id);
-			int fd = mread_socket(m , connection_id);
-			struct sockaddr_in remote_addr;
-			socklen_t len = sizeof(struct sockaddr_in);
-			getpeername(fd, (struct sockaddr *)&remote_addr, &len);
-			_report(g, ctx, "%d open %d %s:%u",id,fd,inet_ntoa(remote_addr.sin_addr),ntohs(remote_addr.sin_port));
-		}
-		uint8_t * plen = mread_pull(m,g->header_size);
-		if (plen == NULL) {
-			if (mread_closed(m)) {
-				_remove_id(g,id);
-				_report(g, ctx, "%d close", id);
+	case PTYPE_SOCKET:
+		_socket_message(ctx, g, msg, (int)sz);
+		break;
+	case PTYPE_RESPONSE:
+		// timer to check the blocked service
+		if (g->block) {
+			if (skynet_overload(g->block)) {
+				skynet_timeout_session(ctx, 1);
+				break;
 			}
-			goto _break;
-		}
-		// big-endian
-		int len ;
-		if (g->header_size == 2) {
-			len = plen[0] << 8 | plen[1];
-		} else {
-			len = plen[0] << 24 | plen[1] << 16 | plen[2] << 8 | plen[3];
+			g->block = 0;
+			_resume(ctx, g);
 		}
-
-		void * data = mread_pull(m, len);
-		if (data == NULL) {
-			if (mread_closed(m)) {
-				_remove_id(g,id);
-				_report(g, ctx, "%d close", id);
-			}
-			goto _break;
-		}
-
-		_forward(ctx, g, id, data, len);
-		mread_yield(m);
-_break:
-		skynet_command(ctx, "TIMEOUT", "0");
+		break;
 	}
 	return 0;
 }
@@ -261,12 +496,16 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	int port = 0;
 	int max = 0;
 	int buffer = 0;
+	int max_send = 0;
+	int cork = 0;
+	int reuseport = 0;
+	int slice = 0;
 	int sz = strlen(parm)+1;
 	char watchdog[sz];
 	char binding[sz];
 	int client_tag = 0;
 	char header;
-	int n = sscanf(parm, "%c %s %s %d %d %d",&header,watchdog, binding,&client_tag , &max,&buffer);
+	int n = sscanf(parm, "%c %s %s %d %d %d %d %d %d %d",&header,watchdog, binding,&client_tag , &max,&buffer,&max_send,&cork,&reuseport,&slice);
 	if (n<4) {
 		skynet_error(ctx, "Invalid gate parm %s",parm);
 		return 1;
@@ -283,7 +522,7 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 		client_tag = PTYPE_CLIENT;
 	}
 	char * portstr = strchr(binding,':');
-	uint32_t addr = INADDR_ANY;
+	const char * host = NULL;
 	if (portstr == NULL) {
 		port = strtol(binding, NULL, 10);
 		if (port <= 0) {
@@ -297,12 +536,7 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 			return 1;
 		}
 		portstr[0] = '\0';
-		addr=inet_addr(binding);
-	}
-	struct mread_pool * pool = mread_create(addr, port, max, buffer);
-	if (pool == NULL) {
-		skynet_error(ctx, "Create gate %s failed",parm);
-		return 1;
+		host = binding;
 	}
 	if (watchdog[0] == '!') {
 		g->watchdog = 0;
@@ -314,25 +548,29 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 		}
 	}
 
-	g->pool = pool;
-	int cap = 1;
-	while (cap < max) {
-		cap *= 2;
-	}
-	g->cap = cap;
+	g->ctx = ctx;
 	g->max_connection = max;
-	g->id_index = 0;
+	g->max_buffer = buffer;
+	g->max_send = max_send;
+	g->cork = cork;
+	g->slice = slice;
 	g->client_tag = client_tag;
 	g->header_size = header=='S' ? 2 : 4;
 
-	g->agent = malloc(cap * sizeof(struct connection *));
-	memset(g->agent, 0, cap * sizeof(struct connection *));
-
-	g->map  = malloc(max * sizeof(struct connection));
-	memset(g->map, 0, max * sizeof(struct connection));
+	hashid_init(&g->hash, max);
+	g->conn = malloc(max * sizeof(struct connection));
+	memset(g->conn, 0, max * sizeof(struct connection));
 	int i;
 	for (i=0;i<max;i++) {
-		g->map[i].connection_id = i;
+		g->conn[i].id = -1;
+	}
+
+	// accept connections after start. with reuseport , many gates (shards) listen on the same port ,
+	// socket ids are unique in the process , so the id reported to watchdog doesn't collide among shards
+	g->listen_id = skynet_socket_listen(ctx, host, port, BACKLOG, reuseport);
+	if (g->listen_id < 0) {
+		skynet_error(ctx, "Listen %s failed", parm);
+		return 1;
 	}
 
 	skynet_callback(ctx,g,_cb);
@@ -2,6 +2,7 @@
 #include <lauxlib.h>
 #include "luacompat52.h"
 #include "localcast.h"
+#include "skynet.h"
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -22,7 +23,7 @@ _pack_message(lua_State *L) {
 	switch(type) {
 	case LUA_TSTRING: {
 		const char * str = lua_tolstring(L,2,&sz);
-		msg = malloc(sz);
+		msg = skynet_malloc(sz);
 		memcpy(msg, str, sz);
 		break;
 	}
@@ -34,7 +35,7 @@ _pack_message(lua_State *L) {
 		luaL_error(L, "type error : %s", lua_typename(L,type));
 		break;
 	}
-	struct localcast *lc = malloc(sizeof(struct localcast));
+	struct localcast *lc = skynet_malloc(sizeof(struct localcast));
 	lc->n = lua_rawlen(L,1);
 	uint32_t *group = malloc(lc->n * sizeof(uint32_t));
 	int i;
@@ -3,6 +3,7 @@
  */
 
 #include "luacompat52.h"
+#include "skynet.h"
 #include <lua.h>
 #include <lauxlib.h>
 #include <stdlib.h>
@@ -25,173 +26,84 @@
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
 
+// initial size of the buffer , it doubles when full
 #define BLOCK_SIZE 128
 #define MAX_DEPTH 32
 
-struct block {
-	struct block * next;
-	char buffer[BLOCK_SIZE];
-};
-
+// The stream is written into one buffer allocated by skynet_malloc ,
+// and the buffer is sent with PTYPE_TAG_DONTCOPY without copy.
 struct write_block {
-	struct block * head;
+	char * buffer;
 	int len;
-	struct block * current;
-	int ptr;
+	int cap;
 };
 
 struct read_block {
 	char * buffer;
-	struct block * current;
 	int len;
 	int ptr;
 };
 
-inline static struct block *
-blk_alloc(void) {
-	struct block *b = malloc(sizeof(struct block));
-	b->next = NULL;
-	return b;
+static void
+wb_grow(struct write_block *b, int sz) {
+	int cap = b->cap * 2;
+	while (cap < b->len + sz) {
+		cap *= 2;
+	}
+	char * buffer = skynet_malloc(cap);
+	memcpy(buffer, b->buffer, b->len);
+	skynet_free(b->buffer);
+	b->buffer = buffer;
+	b->cap = cap;
 }
 
-inline static void
-wb_push(struct write_block *b, const void *buf, int sz) {
-	const char * buffer = buf;
-	if (b->ptr == BLOCK_SIZE) {
-_again:
-		b->current = b->current->next = blk_alloc();
-		b->ptr = 0;
-	}
-	if (b->ptr <= BLOCK_SIZE - sz) {
-		memcpy(b->current->buffer + b->ptr, buffer, sz);
-		b->ptr+=sz;
-		b->len+=sz;
-	} else {
-		int copy = BLOCK_SIZE - b->ptr;
-		memcpy(b->current->buffer + b->ptr, buffer, copy);
-		buffer += copy;
-		b->len += copy;
-		sz -= copy;
-		goto _again;
+// make room for sz bytes , return the write pointer
+static inline char *
+wb_reserve(struct write_block *b, int sz) {
+	if (b->len + sz > b->cap) {
+		wb_grow(b, sz);
 	}
+	return b->buffer + b->len;
 }
 
-static void
-wb_init(struct write_block *wb , struct block *b) {
-	if (b==NULL) {
-		wb->head = blk_alloc();
-		wb->len = 0;
-		wb->current = wb->head;
-		wb->ptr = 0;
-		wb_push(wb, &wb->len, sizeof(wb->len));
-	} else {
-		wb->head = b;
-		int * plen = (int *)b->buffer;
-		int sz = *plen;
-		wb->len = sz;
-		while (b->next) {
-			sz -= BLOCK_SIZE;		
-			b = b->next;
-		}
-		wb->current = b;
-		wb->ptr = sz;
-	}
+static inline void
+wb_push(struct write_block *b, const void *buf, int sz) {
+	char * ptr = wb_reserve(b, sz);
+	memcpy(ptr, buf, sz);
+	b->len += sz;
 }
 
-static struct block *
-wb_close(struct write_block *b) {
-	b->current = b->head;
-	b->ptr = 0;
-	wb_push(b, &b->len, sizeof(b->len));
-	b->current = NULL;
-	return b->head;
+static void
+wb_init(struct write_block *wb) {
+	wb->buffer = skynet_malloc(BLOCK_SIZE);
+	wb->len = 0;
+	wb->cap = BLOCK_SIZE;
 }
 
 static void
 wb_free(struct write_block *wb) {
-	struct block *blk = wb->head;
-	while (blk) {
-		struct block * next = blk->next;
-		free(blk);
-		blk = next;
-	}
-	wb->head = NULL;
-	wb->current = NULL;
-	wb->ptr = 0;
+	skynet_free(wb->buffer);
+	wb->buffer = NULL;
 	wb->len = 0;
+	wb->cap = 0;
 }
 
 static void
 rball_init(struct read_block * rb, char * buffer, int size) {
 	rb->buffer = buffer;
-	rb->current = NULL;
 	rb->len = size;
 	rb->ptr = 0;
 }
 
-static void *
-rb_read(struct read_block *rb, void *buffer, int sz) {
+static inline void *
+rb_read(struct read_block *rb, int sz) {
 	if (rb->len < sz) {
 		return NULL;
 	}
-
-	if (rb->buffer) {
-		int ptr = rb->ptr;
-		rb->ptr += sz;
-		rb->len -= sz;
-		return rb->buffer + ptr;
-	}
-
-	if (rb->ptr == BLOCK_SIZE) {
-		struct block * next = rb->current->next;
-		free(rb->current);
-		rb->current = next;
-		rb->ptr = 0;
-	}
-
-	int copy = BLOCK_SIZE - rb->ptr;
-
-	if (sz <= copy) {
-		void * ret = rb->current->buffer + rb->ptr;
-		rb->ptr += sz;
-		rb->len -= sz;
-		return ret;
-	}
-
-	char * tmp = buffer;
-
-	memcpy(tmp, rb->current->buffer + rb->ptr,  copy);
-	sz -= copy;
-	tmp += copy;
-	rb->len -= copy;
-
-	for (;;) {
-		struct block * next = rb->current->next;
-		free(rb->current);
-		rb->current = next;
-
-		if (sz < BLOCK_SIZE) {
-			memcpy(tmp, rb->current->buffer, sz);
-			rb->ptr = sz;
-			rb->len -= sz;
-			return buffer;
-		}
-		memcpy(tmp, rb->current->buffer, BLOCK_SIZE);
-		sz -= BLOCK_SIZE;
-		tmp += BLOCK_SIZE;
-		rb->len -= BLOCK_SIZE;
-	}
-}
-
-static void
-rb_close(struct read_block *rb) {
-	while (rb->current) {
-		struct block * next = rb->current->next;
-		free(rb->current);
-		rb->current = next;
-	}
-	rb->len = 0;
-	rb->ptr = 0;
+	int ptr = rb->ptr;
+	rb->ptr += sz;
+	rb->len -= sz;
+	return rb->buffer + ptr;
 }
 
 static inline void
@@ -208,35 +120,36 @@ wb_boolean(struct write_block *wb, int boolean) {
 
 static inline void
 wb_integer(struct write_block *wb, int v, int type) {
+	uint8_t * ptr = (uint8_t *)wb_reserve(wb, 5);
 	if (v == 0) {
-		int n = COMBINE_TYPE(type , 0);
-		wb_push(wb, &n, 1);
+		ptr[0] = COMBINE_TYPE(type , 0);
+		wb->len += 1;
 	} else if (v<0) {
-		int n = COMBINE_TYPE(type , 4);
-		wb_push(wb, &n, 1);
-		wb_push(wb, &v, 4);
+		ptr[0] = COMBINE_TYPE(type , 4);
+		memcpy(ptr+1, &v, 4);
+		wb->len += 5;
 	} else if (v<0x100) {
-		int n = COMBINE_TYPE(type , 1);
-		wb_push(wb, &n, 1);
-		uint8_t byte = (uint8_t)v;
-		wb_push(wb, &byte, 1);
+		ptr[0] = COMBINE_TYPE(type , 1);
+		ptr[1] = (uint8_t)v;
+		wb->len += 2;
 	} else if (v<0x10000) {
-		int n = COMBINE_TYPE(type , 2);
-		wb_push(wb, &n, 1);
+		ptr[0] = COMBINE_TYPE(type , 2);
 		uint16_t word = (uint16_t)v;
-		wb_push(wb, &word, 2);
+		memcpy(ptr+1, &word, 2);
+		wb->len += 3;
 	} else {
-		int n = COMBINE_TYPE(type , 4);
-		wb_push(wb, &n, 1);
-		wb_push(wb, &v, 4);
+		ptr[0] = COMBINE_TYPE(type , 4);
+		memcpy(ptr+1, &v, 4);
+		wb->len += 5;
 	}
 }
 
 static inline void
 wb_number(struct write_block *wb, double v) {
-	int n = COMBINE_TYPE(TYPE_NUMBER , 8);
-	wb_push(wb, &n, 1);
-	wb_push(wb, &v, 8);
+	uint8_t * ptr = (uint8_t *)wb_reserve(wb, 9);
+	ptr[0] = COMBINE_TYPE(TYPE_NUMBER , 8);
+	memcpy(ptr+1, &v, 8);
+	wb->len += 9;
 }
 
 static inline void
@@ -249,25 +162,38 @@ wb_pointer(struct write_block *wb, void *v) {
 static inline void
 wb_string(struct write_block *wb, const char *str, int len) {
 	if (len < MAX_COOKIE) {
-		int n = COMBINE_TYPE(TYPE_SHORT_STRING, len);
-		wb_push(wb, &n, 1);
-		if (len > 0) {
-			wb_push(wb, str, len);
-		}
+		uint8_t * ptr = (uint8_t *)wb_reserve(wb, 1 + len);
+		ptr[0] = COMBINE_TYPE(TYPE_SHORT_STRING, len);
+		memcpy(ptr+1, str, len);
+		wb->len += 1 + len;
 	} else {
-		int n;
+		uint8_t * ptr = (uint8_t *)wb_reserve(wb, 5 + len);
+		int hlen;
 		if (len < 0x10000) {
-			n = COMBINE_TYPE(TYPE_LONG_STRING, 2);
-			wb_push(wb, &n, 1);
+			ptr[0] = COMBINE_TYPE(TYPE_LONG_STRING, 2);
 			uint16_t x = (uint16_t) len;
-			wb_push(wb, &x, 2);
+			memcpy(ptr+1, &x, 2);
+			hlen = 3;
 		} else {
-			n = COMBINE_TYPE(TYPE_LONG_STRING, 4);
-			wb_push(wb, &n, 1);
+			ptr[0] = COMBINE_TYPE(TYPE_LONG_STRING, 4);
 			uint32_t x = (uint32_t) len;
-			wb_push(wb, &x, 4);
+			memcpy(ptr+1, &x, 4);
+			hlen = 5;
 		}
-		wb_push(wb, str, len);
+		memcpy(ptr+hlen, str, len);
+		wb->len += hlen + len;
+	}
+}
+
+// number , integer or double
+static inline void
+wb_lua_number(lua_State *L, struct write_block *wb, int index) {
+	lua_Integer x = lua_tointeger(L,index);
+	lua_Number n = lua_tonumber(L,index);
+	if ((lua_Number)x==n) {
+		wb_integer(wb, x, TYPE_NUMBER);
+	} else {
+		wb_number(wb,n);
 	}
 }
 
@@ -285,10 +211,18 @@ wb_table_array(lua_State *L, struct write_block * wb, int index, int depth) {
 		wb_push(wb, &n, 1);
 	}
 
+	// at least one byte for each item
+	wb_reserve(wb, array_size);
+
 	int i;
 	for (i=1;i<=array_size;i++) {
 		lua_rawgeti(L,index,i);
-		_pack_one(L, wb, -1, depth);
+		// fast path for array of numbers
+		if (lua_type(L,-1) == LUA_TNUMBER) {
+			wb_lua_number(L, wb, -1);
+		} else {
+			_pack_one(L, wb, -1, depth);
+		}
 		lua_pop(L,1);
 	}
 
@@ -334,16 +268,9 @@ _pack_one(lua_State *L, struct write_block *b, int index, int depth) {
 	case LUA_TNIL:
 		wb_nil(b);
 		break;
-	case LUA_TNUMBER: {
-		lua_Integer x = lua_tointeger(L,index);
-		lua_Number n = lua_tonumber(L,index);
-		if ((lua_Number)x==n) {
-			wb_integer(b, x, TYPE_NUMBER);
-		} else {
-			wb_number(b,n);
-		}
+	case LUA_TNUMBER:
+		wb_lua_number(L, b, index);
 		break;
-	}
 	case LUA_TBOOLEAN: 
 		wb_boolean(b, lua_toboolean(L,index));
 		break;
@@ -389,11 +316,7 @@ _pack_from(lua_State *L, struct write_block *b, int from) {
 
 static inline void
 __invalid_stream(lua_State *L, struct read_block *rb, int line) {
-	int len = rb->len;
-	if (rb->buffer == NULL) {
-		rb_close(rb);
-	}
-	luaL_error(L, "Invalid serialize stream %d (line:%d)", len, line);
+	luaL_error(L, "Invalid serialize stream %d (line:%d)", rb->len, line);
 }
 
 #define _invalid_stream(L,rb) __invalid_stream(L,rb,__LINE__)
@@ -404,22 +327,19 @@ _get_integer(lua_State *L, struct read_block *rb, int cookie) {
 	case 0:
 		return 0;
 	case 1: {
-		uint8_t n = 0;
-		uint8_t * pn = rb_read(rb,&n,1);
+		uint8_t * pn = rb_read(rb,1);
 		if (pn == NULL)
 			_invalid_stream(L,rb);
 		return *pn;
 	}
 	case 2: {
-		uint16_t n = 0;
-		uint16_t * pn = rb_read(rb,&n,2);
+		uint16_t * pn = rb_read(rb,2);
 		if (pn == NULL)
 			_invalid_stream(L,rb);
 		return *pn;
 	}
 	case 4: {
-		int n = 0;
-		int * pn = rb_read(rb,&n,4);
+		int * pn = rb_read(rb,4);
 		if (pn == NULL)
 			_invalid_stream(L,rb);
 		return *pn;
@@ -433,8 +353,7 @@ _get_integer(lua_State *L, struct read_block *rb, int cookie) {
 static double
 _get_number(lua_State *L, struct read_block *rb, int cookie) {
 	if (cookie == 8) {
-		double n = 0;
-		double * pn = rb_read(rb,&n,8);
+		double * pn = rb_read(rb,8);
 		if (pn == NULL)
 			_invalid_stream(L,rb);
 		return *pn;
@@ -445,8 +364,7 @@ _get_number(lua_State *L, struct read_block *rb, int cookie) {
 
 static void *
 _get_pointer(lua_State *L, struct read_block *rb) {
-	void * userdata = 0;
-	void ** v = (void **)rb_read(rb,&userdata,sizeof(userdata));
+	void ** v = (void **)rb_read(rb,sizeof(void *));
 	if (v == NULL) {
 		_invalid_stream(L,rb);
 	}
@@ -455,8 +373,10 @@ _get_pointer(lua_State *L, struct read_block *rb) {
 
 static void
 _get_buffer(lua_State *L, struct read_block *rb, int len) {
-	char tmp[len];
-	char * p = rb_read(rb,tmp,len);
+	char * p = rb_read(rb,len);
+	if (p == NULL) {
+		_invalid_stream(L,rb);
+	}
 	lua_pushlstring(L,p,len);
 }
 
@@ -465,8 +385,7 @@ static void _unpack_one(lua_State *L, struct read_block *rb);
 static void
 _unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 	if (array_size == MAX_COOKIE-1) {
-		uint8_t type = 0;
-		uint8_t *t = rb_read(rb, &type, 1);
+		uint8_t *t = rb_read(rb,1);
 		if (t==NULL || (*t & 7) != TYPE_NUMBER) {
 			_invalid_stream(L,rb);
 		}
@@ -508,9 +427,8 @@ _push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		_get_buffer(L,rb,cookie);
 		break;
 	case TYPE_LONG_STRING: {
-		uint32_t len;
 		if (cookie == 2) {
-			uint16_t *plen = rb_read(rb, &len, 2);
+			uint16_t *plen = rb_read(rb,2);
 			if (plen == NULL) {
 				_invalid_stream(L,rb);
 			}
@@ -519,7 +437,7 @@ _push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 			if (cookie != 4) {
 				_invalid_stream(L,rb);
 			}
-			uint32_t *plen = rb_read(rb, &len, 4);
+			uint32_t *plen = rb_read(rb,4);
 			if (plen == NULL) {
 				_invalid_stream(L,rb);
 			}
@@ -553,48 +471,13 @@ _push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 
 static void
 _unpack_one(lua_State *L, struct read_block *rb) {
-	uint8_t type = 0;
-	uint8_t *t = rb_read(rb, &type, 1);
+	uint8_t *t = rb_read(rb,1);
 	if (t==NULL) {
 		_invalid_stream(L, rb);
 	}
 	_push_value(L, rb, *t & 0x7, *t>>3);
 }
 
-static void
-_seri(lua_State *L, struct block *b) {
-	uint32_t len = 0;
-	memcpy(&len, b->buffer ,sizeof(len));
-
-	len -= 4;
-	uint8_t * buffer = malloc(len);
-	uint8_t * ptr = buffer;
-	int sz = len;
-	if (len < BLOCK_SIZE - 4) {
-		memcpy(ptr, b->buffer+4, len);
-	} else {
-		memcpy(ptr, b->buffer+4, BLOCK_SIZE-4);
-		ptr += BLOCK_SIZE-4;
-		len -= BLOCK_SIZE-4;
-		b = b->next;
-
-		while(len>0) {
-			if (len >= BLOCK_SIZE) {
-				memcpy(ptr, b->buffer, BLOCK_SIZE);
-				ptr += BLOCK_SIZE;
-				len -= BLOCK_SIZE;
-			} else {
-				memcpy(ptr, b->buffer, len);
-				break;
-			}
-			b = b->next;
-		}
-	}
-	
-	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, sz);
-}
-
 int
 _luaseri_unpack(lua_State *L) {
 	if (lua_isnoneornil(L,1)) {
@@ -615,8 +498,7 @@ _luaseri_unpack(lua_State *L) {
 		if (i%16==15) {
 			lua_checkstack(L,i);
 		}
-		uint8_t type = 0;
-		uint8_t *t = rb_read(&rb, &type, 1);
+		uint8_t *t = rb_read(&rb,1);
 		if (t==NULL)
 			break;
 		_push_value(L, &rb, *t & 0x7, *t>>3);
@@ -630,16 +512,10 @@ _luaseri_unpack(lua_State *L) {
 int
 _luaseri_pack(lua_State *L) {
 	struct write_block wb;
-	wb_init(&wb, NULL);
+	wb_init(&wb);
 	_pack_from(L,&wb,0);
-	struct block * b = wb_close(&wb);
-	_seri(L,b);
-
-	while (b) {
-		struct block * next = b->next;
-		free(b);
-		b = next;
-	}
+	lua_pushlightuserdata(L, wb.buffer);
+	lua_pushinteger(L, wb.len);
 
 	return 2;
 }
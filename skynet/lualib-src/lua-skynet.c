@@ -27,6 +27,8 @@ struct stat {
 	uint32_t ti_nsec;
 	struct trace_pool *trace;
 	struct snlua *lua;
+	int type;	// type of the message in dispatch
+	int profile;	// instructions between two samples , 0 for off
 };
 
 static void
@@ -69,15 +71,128 @@ _stat(lua_State *L) {
 		lua_pushlightuserdata(L, S->trace);
 		return 1;
 	}
+	if (strcmp(what,"mem")==0) {
+		lua_pushnumber(L, (lua_Number)S->lua->mem);
+		return 1;
+	}
+	if (strcmp(what,"memlimit")==0) {
+		lua_pushnumber(L, (lua_Number)S->lua->mem_limit);
+		return 1;
+	}
 	return 0;
 }
 
+// Sampling profiler : a count hook takes a sample of lua stack every S->profile instructions ,
+// and counts the samples by collapsed stack ("type;outer;...;inner") in a registry table.
+
+#define PROFILE_DEPTH 32
+#define PROFILE_FRAME 96
+
+static const char * PROFILE_TYPE[] = {
+	"text", "response", "multicast", "client", "system", "harbor", "socket", "error",
+};
+
+static void
+_profile_hook(lua_State *L, lua_Debug *ar) {
+	lua_rawgetp(L, LUA_REGISTRYINDEX, _stat);
+	struct stat *S = lua_touserdata(L,-1);
+	lua_pop(L,1);
+	if (S == NULL || S->profile == 0) {
+		lua_sethook(L, NULL, 0, 0);
+		return;
+	}
+	char frame[PROFILE_DEPTH][PROFILE_FRAME];
+	lua_Debug d;
+	int n = 0;
+	while (n < PROFILE_DEPTH && lua_getstack(L, n, &d)) {
+		lua_getinfo(L, "Sn", &d);
+		snprintf(frame[n], PROFILE_FRAME, "%s@%s:%d", d.name ? d.name : "?", d.short_src, d.linedefined);
+		++n;
+	}
+	char stack[PROFILE_DEPTH * PROFILE_FRAME + 16];
+	int sz;
+	if (S->type >= 0 && S->type < (int)(sizeof(PROFILE_TYPE)/sizeof(PROFILE_TYPE[0]))) {
+		sz = sprintf(stack, "%s", PROFILE_TYPE[S->type]);
+	} else {
+		sz = sprintf(stack, "type%d", S->type);
+	}
+	while (n > 0) {
+		--n;
+		sz += sprintf(stack + sz, ";%s", frame[n]);
+	}
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, _profile_hook);
+	if (!lua_istable(L,-1)) {
+		lua_pop(L,1);
+		return;
+	}
+	lua_pushlstring(L, stack, sz);
+	lua_pushvalue(L,-1);
+	lua_rawget(L,-3);
+	lua_Integer count = lua_tointeger(L,-1);
+	lua_pop(L,1);
+	lua_pushinteger(L, count + 1);
+	lua_rawset(L,-3);
+	lua_pop(L,1);
+}
+
+// count > 0 starts profiler , 0 stops it and returns { stack = samples }
+static int
+_profile(lua_State *L) {
+	lua_rawgetp(L, LUA_REGISTRYINDEX, _stat);
+	struct stat *S = lua_touserdata(L,-1);
+	if (S==NULL) {
+		return luaL_error(L, "set callback first");
+	}
+	int count = luaL_checkinteger(L,1);
+	if (count > 0) {
+		S->profile = count;
+		lua_newtable(L);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, _profile_hook);
+		lua_sethook(S->L, _profile_hook, LUA_MASKCOUNT, count);
+		lua_sethook(L, _profile_hook, LUA_MASKCOUNT, count);
+		return 0;
+	}
+	// the hook of each coroutine removes itself
+	S->profile = 0;
+	lua_rawgetp(L, LUA_REGISTRYINDEX, _profile_hook);
+	lua_pushnil(L);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, _profile_hook);
+	return 1;
+}
+
+// hooks are per coroutine , attach the profiler to a coroutine before resume it
+static int
+_profile_attach(lua_State *L) {
+	lua_State *co = lua_tothread(L,1);
+	lua_rawgetp(L, LUA_REGISTRYINDEX, _stat);
+	struct stat *S = lua_touserdata(L,-1);
+	if (co && S && S->profile && lua_gethook(co) != _profile_hook) {
+		lua_sethook(co, _profile_hook, LUA_MASKCOUNT, S->profile);
+	}
+	return 0;
+}
+
+static int
+_memlimit(lua_State *L) {
+	lua_getfield(L, LUA_REGISTRYINDEX, "skynet_lua");
+	struct snlua *lua = lua_touserdata(L,-1);
+	if (lua == NULL) {
+		return luaL_error(L, "Init skynet context first");
+	}
+	// bytes , 0 for unlimited
+	lua_pushnumber(L, (lua_Number)lua->mem_limit);
+	lua->mem_limit = (size_t)luaL_checknumber(L,1);
+	return 1;
+}
+
 static int
 _cb(struct skynet_context * context, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
 	struct stat *S = ud;
 	lua_State *L = S->L;
 	struct timespec ti;
 	_stat_begin(S, &ti);
+	S->type = type;
 	int trace = 1;
 	int top = lua_gettop(L);
 	if (top == 1) {
@@ -103,7 +218,9 @@ _cb(struct skynet_context * context, void * ud, int type, int session, uint32_t
 			assert(lua->L == L);
 			const char * cmd = lua->reload;
 			lua->reload = NULL;
-			lua->L = luaL_newstate();
+			lua->L = lua->newstate(lua);
+			// compile the sources again
+			lua->clear_cache();
 			int err = lua->init(lua, context, cmd);
 			if (err) {
 				skynet_callback(context, S, _cb);
@@ -196,6 +313,63 @@ _command(lua_State *L) {
 	return 0;
 }
 
+static int
+_timeout(lua_State *L) {
+	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
+	int ti = luaL_checkinteger(L,1);
+	int session = skynet_timeout_session(context, ti);
+	if (session < 0) {
+		return luaL_error(L, "skynet.timeout session (%d) < 0", session);
+	}
+	lua_pushinteger(L, session);
+	return 1;
+}
+
+static int
+_timeout_ms(lua_State *L) {
+	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
+	int ti = luaL_checkinteger(L,1);
+	int session = skynet_timeout_session_ms(context, ti);
+	if (session < 0) {
+		return luaL_error(L, "skynet.timeout_ms session (%d) < 0", session);
+	}
+	lua_pushinteger(L, session);
+	return 1;
+}
+
+static int
+_cancel(lua_State *L) {
+	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
+	int session = luaL_checkinteger(L,1);
+	lua_pushboolean(L, skynet_cancel(context, session) == 0);
+	return 1;
+}
+
+static int
+_self(lua_State *L) {
+	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
+	lua_pushunsigned(L, skynet_self(context));
+	return 1;
+}
+
+static int
+_now(lua_State *L) {
+	lua_pushunsigned(L, skynet_now());
+	return 1;
+}
+
+static int
+_now_ms(lua_State *L) {
+	lua_pushnumber(L, (lua_Number)skynet_now_ms());
+	return 1;
+}
+
+static int
+_starttime(lua_State *L) {
+	lua_pushunsigned(L, skynet_starttime());
+	return 1;
+}
+
 static int
 _genid(lua_State *L) {
 	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
@@ -237,6 +411,11 @@ _sendname(lua_State *L, struct skynet_context * context, const char * dest) {
 	default:
 		luaL_error(L, "skynet.send invalid param %s", lua_type(L,4));
 	}
+	if (session == -2) {
+		// mailbox of destination is full
+		lua_pushboolean(L,0);
+		return 1;
+	}
 	if (session < 0) {
 		luaL_error(L, "skynet.send session (%d) < 0", session);
 	}
@@ -308,6 +487,11 @@ _send(lua_State *L) {
 	default:
 		luaL_error(L, "skynet.send invalid param %s", lua_type(L,4));
 	}
+	if (session == -2) {
+		// mailbox of destination is full
+		lua_pushboolean(L,0);
+		return 1;
+	}
 	if (session < 0) {
 		luaL_error(L, "skynet.send session (%d) < 0", session);
 	}
@@ -373,6 +557,23 @@ _tostring(lua_State *L) {
 	return 1;
 }
 
+static int
+_ref(lua_State *L) {
+	luaL_checktype(L,1,LUA_TLIGHTUSERDATA);
+	void * msg = lua_touserdata(L,1);
+	int n = luaL_optinteger(L,2,1);
+	skynet_ref(msg, n);
+	lua_settop(L,1);
+	return 1;
+}
+
+static int
+_unref(lua_State *L) {
+	luaL_checktype(L,1,LUA_TLIGHTUSERDATA);
+	skynet_free(lua_touserdata(L,1));
+	return 0;
+}
+
 static int
 _harbor(lua_State *L) {
 	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
@@ -462,14 +663,26 @@ luaopen_skynet_c(lua_State *L) {
 		{ "redirect", _redirect },
 		{ "forward", _forward },
 		{ "command" , _command },
+		{ "timeout", _timeout },
+		{ "timeout_ms", _timeout_ms },
+		{ "cancel", _cancel },
+		{ "self", _self },
+		{ "now", _now },
+		{ "now_ms", _now_ms },
+		{ "starttime", _starttime },
 		{ "error", _error },
 		{ "tostring", _tostring },
+		{ "ref", _ref },
+		{ "unref", _unref },
 		{ "harbor", _harbor },
 		{ NULL, NULL },
 	};
 
 	luaL_Reg l2[] = {
 		{ "stat", _stat },
+		{ "memlimit", _memlimit },
+		{ "profile", _profile },
+		{ "profile_attach", _profile_attach },
 		{ "remote_init", remoteobj_init },
 		{ "trace_new", _trace_new },
 		{ "trace_delete", _trace_delete },
@@ -28,6 +28,33 @@ local sleep_session = {}
 local trace_handle
 local trace_func = function() end
 
+-- it's replaced by skynet.profile , attach profiler to the coroutine before resume
+local coroutine_resume = coroutine.resume
+local resume = coroutine_resume
+
+-- finished coroutines wait in the pool for the next function , see co_create
+local coroutine_pool = {}
+local coroutine_yield = coroutine.yield
+
+local function co_create(f)
+	local co = table.remove(coroutine_pool)
+	if co == nil then
+		co = coroutine.create(function(...)
+			f(...)
+			while true do
+				f = nil
+				coroutine_pool[#coroutine_pool+1] = co
+				f = coroutine_yield "EXIT"
+				f(coroutine_yield())
+			end
+		end)
+	else
+		-- pass f in , the next resume calls it
+		resume(co, f)
+	end
+	return co
+end
+
 -- suspend is function
 local suspend
 
@@ -38,7 +65,7 @@ local function dispatch_wakeup()
 		local session = sleep_session[co]
 		if session then
 			session_id_coroutine[session] = "BREAK"
-			return suspend(co, coroutine.resume(co, true))
+			return suspend(co, resume(co, true))
 		end
 	end
 end
@@ -73,9 +100,9 @@ function suspend(co, result, command, param, size)
 			error(debug.traceback(co))
 		end
 		c.send(co_address, 1, co_session, param, size)
-		return suspend(co, coroutine.resume(co))
-	elseif command == nil then
-		-- coroutine exit
+		return suspend(co, resume(co))
+	elseif command == "EXIT" then
+		-- coroutine exit , it's in coroutine_pool now
 		session_coroutine_id[co] = nil
 		session_coroutine_address[co] = nil
 	else
@@ -86,19 +113,33 @@ function suspend(co, result, command, param, size)
 	dispatch_wakeup()
 end
 
-function skynet.timeout(ti, func)
-	local session = c.command("TIMEOUT",tostring(ti))
-	assert(session)
-	session = tonumber(session)
-	local co = coroutine.create(func)
+function skynet.timeout(ti, func, timeout)
+	local session = (timeout or c.timeout)(ti)
+	local co = co_create(func)
 	assert(session_id_coroutine[session] == nil)
 	session_id_coroutine[session] = co
+	return session
+end
+
+-- ti is millisecond , the precision is the tick in config
+function skynet.timeout_ms(ti, func)
+	return skynet.timeout(ti, func, c.timeout_ms)
+end
+
+-- cancel a timer created by skynet.timeout , func will not be called
+function skynet.cancel(session)
+	if session_id_coroutine[session] then
+		if c.cancel(session) then
+			session_id_coroutine[session] = nil
+		else
+			-- expired , the response is on the way
+			session_id_coroutine[session] = "BREAK"
+		end
+	end
 end
 
-function skynet.sleep(ti)
-	local session = c.command("TIMEOUT",tostring(ti))
-	assert(session)
-	session = tonumber(session)
+function skynet.sleep(ti, timeout)
+	local session = (timeout or c.timeout)(ti)
 	local ret = coroutine.yield("SLEEP", session)
 	sleep_session[coroutine.running()] = nil
 	if ret == true then
@@ -107,10 +148,13 @@ function skynet.sleep(ti)
 	end
 end
 
+function skynet.sleep_ms(ti)
+	return skynet.sleep(ti, c.timeout_ms)
+end
+
 function skynet.yield()
-	local session = c.command("TIMEOUT","0")
-	assert(session)
-	coroutine.yield("SLEEP", tonumber(session))
+	local session = c.timeout(0)
+	coroutine.yield("SLEEP", session)
 	sleep_session[coroutine.running()] = nil
 end
 
@@ -131,7 +175,7 @@ function skynet.self()
 	if self_handle then
 		return self_handle
 	end
-	self_handle = string_to_handle(c.command("REG"))
+	self_handle = c.self()
 	return self_handle
 end
 
@@ -142,13 +186,9 @@ function skynet.launch(...)
 	end
 end
 
-function skynet.now()
-	return tonumber(c.command("NOW"))
-end
-
-function skynet.starttime()
-	return tonumber(c.command("STARTTIME"))
-end
+skynet.now = assert(c.now)
+skynet.now_ms = assert(c.now_ms)
+skynet.starttime = assert(c.starttime)
 
 function skynet.exit()
 	skynet.send(".launcher","lua","REMOVE",skynet.self())
@@ -171,6 +211,55 @@ function skynet.setenv(key, value)
 	c.command("SETENV",key .. " " ..value)
 end
 
+-- size class list of message allocator , each is "size alloc inuse carve"
+function skynet.slab()
+	local list = {}
+	local i = 0
+	while true do
+		local s = c.command("SLAB", tostring(i))
+		if s == nil then
+			return list
+		end
+		i = i + 1
+		list[i] = s
+	end
+end
+
+-- kind is "wait" , "run" (microsecond) or "depth" (messages) , return count and upper bounds of p50 p90 p99 max
+function skynet.stat(kind)
+	local s = c.command("STAT", kind)
+	if s then
+		local count, p50, p90, p99, max = string.match(s, "(%d+) (%d+) (%d+) (%d+) (%d+)")
+		return { count = tonumber(count), p50 = tonumber(p50), p90 = tonumber(p90), p99 = tonumber(p99), max = tonumber(max) }
+	end
+end
+
+-- bytes of lua memory , 0 for unlimited ; return the old limit , see lua_memlimit in config
+skynet.memlimit = assert(c.memlimit)
+
+-- pin the service to workers such as "0,2-3" , "*" for any worker ; return the workers list
+function skynet.affinity(workers)
+	return c.command("AFFINITY", workers or "")
+end
+
+-- limit 0 for unlimited , policy is "reject" (default) , "drop" or "block" ; return length limit policy
+function skynet.mailbox(limit, policy)
+	local param = limit and string.format("%d %s", limit, policy or "reject") or ""
+	local length, limit, policy = string.match(c.command("MAILBOX", param), "(%d+) (%d+) (%a*)")
+	return tonumber(length), tonumber(limit), policy
+end
+
+-- get the messages sent as slices (gate with slice option) without copy , then the service must not
+-- keep a message by skynet.ref or pass it on by skynet.redirect ; return true if it's on
+function skynet.slice(on)
+	return c.command("SLICE", on == false and "0" or "1") == "1"
+end
+
+function skynet.drain(n, usec, weight)
+	c.command("DRAIN", string.format("%d %d %d", n, usec or 0, weight or -1))
+end
+
+-- return false if the mailbox of addr is full , see skynet.mailbox
 function skynet.send(addr, typename, ...)
 	local p = proto[typename]
 	return c.send(addr, p.id, 0 , p.pack(...))
@@ -193,24 +282,36 @@ end
 skynet.pack = assert(c.pack)
 skynet.unpack = assert(c.unpack)
 skynet.tostring = assert(c.tostring)
+-- skynet.ref(msg [, n]) keeps the message after dispatch , or shares it with n more destinations without copy.
+-- Sending a userdata message (skynet.redirect) passes one holder to the destination , skynet.unref(msg) drops one.
+skynet.ref = assert(c.ref)
+skynet.unref = assert(c.unref)
+
+local function yield_call(addr, session)
+	local msg, sz = coroutine.yield("CALL", session)
+	if msg == false then
+		error(string.format("Call to %s is dropped : mailbox is full", tostring(addr)))
+	end
+	return msg, sz
+end
 
 function skynet.call(addr, typename, ...)
 	local p = proto[typename]
 	local session = c.send(addr, p.id , nil , p.pack(...))
-	return p.unpack(coroutine.yield("CALL", session))
+	return p.unpack(yield_call(addr, session))
 end
 
 function skynet.blockcall(addr, typename , ...)
 	local p = proto[typename]
 	c.command("LOCK")
 	local session = c.send(addr, p.id , nil , p.pack(...))
-	return p.unpack(coroutine.yield("CALL", session))
+	return p.unpack(yield_call(addr, session))
 end
 
 function skynet.rawcall(addr, typename, msg, sz)
 	local p = proto[typename]
 	local session = c.send(addr, p.id , nil , msg, sz)
-	return coroutine.yield("CALL", session)
+	return yield_call(addr, session)
 end
 
 function skynet.ret(msg, sz)
@@ -246,15 +347,15 @@ local fork_queue = {}
 
 function skynet.fork(func,...)
 	local args = { ... }
-	local co = coroutine.create(function()
+	local co = co_create(function()
 		func(unpack(args))
 	end)
 	table.insert(fork_queue, co)
 end
 
 local function dispatch_message(prototype, msg, sz, session, source, ...)
-	-- PTYPE_RESPONSE = 1, read skynet.h
-	if prototype == 1 then
+	-- PTYPE_RESPONSE = 1, PTYPE_ERROR = 7 , read skynet.h
+	if prototype == 1 or prototype == 7 then
 		local co = session_id_coroutine[session]
 		if co == "BREAK" then
 			session_id_coroutine[session] = nil
@@ -264,16 +365,21 @@ local function dispatch_message(prototype, msg, sz, session, source, ...)
 		else
 			c.trace_switch(trace_handle, session)
 			session_id_coroutine[session] = nil
-			suspend(co, coroutine.resume(co, msg, sz))
+			if prototype == 7 then
+				-- the request is dropped , see yield_call
+				suspend(co, resume(co, false))
+			else
+				suspend(co, resume(co, msg, sz))
+			end
 		end
 	else
 		local p = assert(proto[prototype], prototype)
 		local f = p.dispatch
 		if f then
-			local co = coroutine.create(f)
+			local co = co_create(f)
 			session_coroutine_id[co] = session
 			session_coroutine_address[co] = source
-			suspend(co, coroutine.resume(co, session,source, p.unpack(msg,sz, ...)))
+			suspend(co, resume(co, session,source, p.unpack(msg,sz, ...)))
 		else
 			print("Unknown request :" , p.unpack(msg,sz))
 			error(string.format("Can't dispatch type %s : ", p.name))
@@ -285,7 +391,7 @@ local function dispatch_message(prototype, msg, sz, session, source, ...)
 			return
 		end
 		fork_queue[key] = nil
-		suspend(co,coroutine.resume(co))
+		suspend(co,resume(co))
 	end
 end
 
@@ -434,6 +540,33 @@ function skynet.info_func(func)
 	internal_info_func = func
 end
 
+-- count > 0 : take a sample every count instructions ,
+-- otherwise stop and return collapsed stacks ("type;frame;...;frame samples" per line) for flamegraph.pl
+function skynet.profile(count)
+	if count and count > 0 then
+		c.profile(count)
+		local attach = c.profile_attach
+		resume = function(co, ...)
+			attach(co)
+			return coroutine_resume(co, ...)
+		end
+		return
+	end
+	resume = coroutine_resume
+	local samples = c.profile(0)
+	if samples == nil then
+		return nil, 0
+	end
+	local lines = {}
+	local total = 0
+	for stack, n in pairs(samples) do
+		table.insert(lines, stack .. " " .. n)
+		total = total + n
+	end
+	table.sort(lines)
+	return table.concat(lines, "\n"), total
+end
+
 local dbgcmd = {}
 
 function dbgcmd.MEM()
@@ -453,6 +586,11 @@ function dbgcmd.STAT()
 	local stat = {}
 	query_state(stat, "count")
 	query_state(stat, "time")
+	query_state(stat, "mem")
+	query_state(stat, "memlimit")
+	stat.wait = skynet.stat "wait"
+	stat.run = skynet.stat "run"
+	stat.depth = skynet.stat "depth"
 	skynet.ret(skynet.pack(stat))
 end
 
@@ -464,6 +602,10 @@ function dbgcmd.INFO()
 	end
 end
 
+function dbgcmd.PROFILE(count)
+	skynet.ret(skynet.pack(skynet.profile(count)))
+end
+
 function dbgcmd.RELOAD(...)
 	local cmd = table.concat({...}, " ")
 	c.reload(cmd)
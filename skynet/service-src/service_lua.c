@@ -5,11 +5,211 @@
 #include <lauxlib.h>
 #include "luacompat52.h"
 #include "service_lua.h"
+#include "rwlock.h"
 
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/stat.h>
+
+#if LUA_VERSION_NUM == 501
+#define LUA_SEARCHERS "loaders"
+#else
+#define LUA_SEARCHERS "searchers"
+#endif
+
+// Compiled chunks of services and the modules they require are cached for all snlua services
+// in the process , so launching the same service again doesn't parse the source. An entry is
+// stale when mtime or size of the file changes , and the whole cache is cleared by lua reload.
+// Set luacache = 0 in config to turn it off.
+
+#define CACHE_SLOT 256
+
+struct chunk {
+	struct chunk * next;
+	char * name;	// "@" .. filename , the chunkname of luaL_loadfile
+	time_t mtime;
+	off_t size;
+	size_t sz;
+	char * code;
+};
+
+struct chunk_cache {
+	struct rwlock lock;
+	struct chunk * slot[CACHE_SLOT];
+};
+
+static struct chunk_cache CACHE;
+
+struct dump_buffer {
+	char * buf;
+	size_t sz;
+	size_t cap;
+};
+
+static unsigned
+_hash(const char * str) {
+	unsigned h = 0;
+	for (;*str;str++) {
+		h = h * 31 + (unsigned char)*str;
+	}
+	return h % CACHE_SLOT;
+}
+
+static int
+_writer(lua_State *L, const void * p, size_t sz, void * ud) {
+	struct dump_buffer * d = ud;
+	if (d->sz + sz > d->cap) {
+		size_t cap = d->cap ? d->cap : 1024;
+		while (cap < d->sz + sz) {
+			cap *= 2;
+		}
+		d->buf = realloc(d->buf, cap);
+		d->cap = cap;
+	}
+	memcpy(d->buf + d->sz, p, sz);
+	d->sz += sz;
+	return 0;
+}
+
+static struct chunk *
+_find(unsigned h, const char * filename) {
+	struct chunk * c = CACHE.slot[h];
+	while (c) {
+		if (strcmp(c->name + 1, filename) == 0) {
+			return c;
+		}
+		c = c->next;
+	}
+	return NULL;
+}
+
+static void
+_insert(const char * filename, struct stat *st, struct dump_buffer *d) {
+	unsigned h = _hash(filename);
+	rwlock_wlock(&CACHE.lock);
+	struct chunk * c = _find(h, filename);
+	if (c == NULL) {
+		size_t len = strlen(filename);
+		c = malloc(sizeof(*c));
+		c->name = malloc(len + 2);
+		c->name[0] = '@';
+		memcpy(c->name + 1, filename, len + 1);
+		c->next = CACHE.slot[h];
+		CACHE.slot[h] = c;
+	} else {
+		free(c->code);
+	}
+	c->mtime = st->st_mtime;
+	c->size = st->st_size;
+	c->sz = d->sz;
+	c->code = d->buf;
+	rwlock_wunlock(&CACHE.lock);
+}
+
+static void
+_cache_clear(void) {
+	rwlock_wlock(&CACHE.lock);
+	int i;
+	for (i=0;i<CACHE_SLOT;i++) {
+		struct chunk * c = CACHE.slot[i];
+		while (c) {
+			struct chunk * next = c->next;
+			free(c->name);
+			free(c->code);
+			free(c);
+			c = next;
+		}
+		CACHE.slot[i] = NULL;
+	}
+	rwlock_wunlock(&CACHE.lock);
+}
+
+static int
+_cache_on(void) {
+	const char * on = skynet_command(NULL, "GETENV", "luacache");
+	return on == NULL || strcmp(on, "0") != 0;
+}
+
+// the same as luaL_loadfile , but load the chunk from cache if it's not changed
+static int
+_cache_load(lua_State *L, const char * filename) {
+	struct stat st;
+	if (!_cache_on() || stat(filename, &st) != 0) {
+		return luaL_loadfile(L, filename);
+	}
+	unsigned h = _hash(filename);
+	rwlock_rlock(&CACHE.lock);
+	struct chunk * c = _find(h, filename);
+	if (c && c->mtime == st.st_mtime && c->size == st.st_size) {
+		int r = luaL_loadbuffer(L, c->code, c->sz, c->name);
+		rwlock_runlock(&CACHE.lock);
+		return r;
+	}
+	rwlock_runlock(&CACHE.lock);
+
+	int r = luaL_loadfile(L, filename);
+	if (r != LUA_OK) {
+		return r;
+	}
+	struct dump_buffer d = { NULL, 0, 0 };
+	if (lua_dump(L, _writer, &d) == 0) {
+		_insert(filename, &st, &d);
+	} else {
+		free(d.buf);
+	}
+	return LUA_OK;
+}
+
+static int
+_readable(const char * filename) {
+	FILE *f = fopen(filename, "r");
+	if (f == NULL) {
+		return 0;
+	}
+	fclose(f);
+	return 1;
+}
+
+// replace the lua searcher of package , load modules by _cache_load
+static int
+_searcher(lua_State *L) {
+	const char * name = luaL_checkstring(L,1);
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "path");
+	const char * path = lua_tostring(L, -1);
+	if (path == NULL) {
+		return luaL_error(L, "'package.path' must be a string");
+	}
+	name = luaL_gsub(L, name, ".", LUA_DIRSEP);
+	lua_pushliteral(L, "");
+	while (*path) {
+		const char * end = strchr(path, ';');
+		size_t len = end ? (size_t)(end - path) : strlen(path);
+		if (len > 0) {
+			lua_pushlstring(L, path, len);
+			const char * filename = luaL_gsub(L, lua_tostring(L, -1), "?", name);
+			lua_remove(L, -2);
+			if (_readable(filename)) {
+				if (_cache_load(L, filename) != LUA_OK) {
+					return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s",
+						lua_tostring(L, 1), filename, lua_tostring(L, -1));
+				}
+				lua_pushstring(L, filename);
+				return 2;
+			}
+			lua_pushfstring(L, "\n\tno file '%s'", filename);
+			lua_remove(L, -2);
+			lua_concat(L, 2);
+		}
+		path += len;
+		if (*path == ';') {
+			++path;
+		}
+	}
+	return 1;
+}
 
 static int
 _try_load(lua_State *L, const char * path, int pathlen, const char * name) {
@@ -34,7 +234,7 @@ _try_load(lua_State *L, const char * path, int pathlen, const char * name) {
 		return -1;
 	} else {
 		fclose(f);
-		int r = luaL_loadfile(L,tmp);
+		int r = _cache_load(L,tmp);
 		if (r == LUA_OK) {
 			int i;
 			for (i=namelen+pathlen-2;i>=0;i--) {
@@ -86,6 +286,153 @@ _load(lua_State *L, char ** filename) {
 	return -1;
 }
 
+// Each service has its own pool for small objects , only the worker dispatching the service
+// touches it , so no lock needed. Larger objects go to malloc. Every byte is counted in snlua.mem.
+
+#define POOL_CLASS 8
+#define POOL_SHIFT 4
+#define POOL_PAGE (16 * 1024)
+#define POOL_HEADER 16
+
+#define MEMORY_WARNING_REPORT (32 * 1024 * 1024)
+
+struct snlua_pool {
+	void * freelist[POOL_CLASS];
+	void * page;
+	char * ptr;
+	size_t left;
+};
+
+static inline int
+_pool_class(size_t sz) {
+	return (int)((sz + (1 << POOL_SHIFT) - 1) >> POOL_SHIFT) - 1;
+}
+
+static void *
+_pool_alloc(struct snlua_pool *p, size_t sz) {
+	int c = _pool_class(sz);
+	if (c >= POOL_CLASS) {
+		return malloc(sz);
+	}
+	void * ptr = p->freelist[c];
+	if (ptr) {
+		p->freelist[c] = *(void **)ptr;
+		return ptr;
+	}
+	size_t csz = (size_t)(c + 1) << POOL_SHIFT;
+	if (p->left < csz) {
+		// the first bytes of page link all the pages , the rest of old page is wasted
+		char * page = malloc(POOL_PAGE);
+		if (page == NULL) {
+			return NULL;
+		}
+		*(void **)page = p->page;
+		p->page = page;
+		p->ptr = page + POOL_HEADER;
+		p->left = POOL_PAGE - POOL_HEADER;
+	}
+	ptr = p->ptr;
+	p->ptr += csz;
+	p->left -= csz;
+	return ptr;
+}
+
+static void
+_pool_free(struct snlua_pool *p, void * ptr, size_t sz) {
+	int c = _pool_class(sz);
+	if (c >= POOL_CLASS) {
+		free(ptr);
+		return;
+	}
+	*(void **)ptr = p->freelist[c];
+	p->freelist[c] = ptr;
+}
+
+static void
+_pool_release(struct snlua_pool *p) {
+	void * page = p->page;
+	while (page) {
+		void * next = *(void **)page;
+		free(page);
+		page = next;
+	}
+	free(p);
+}
+
+static void *
+_lalloc(void * ud, void * ptr, size_t osize, size_t nsize) {
+	struct snlua *l = ud;
+	if (ptr == NULL) {
+		// osize is the type of object
+		osize = 0;
+	}
+	if (nsize > osize && l->mem_limit && l->mem - osize + nsize > l->mem_limit) {
+		// lua raises LUA_ERRMEM
+		return NULL;
+	}
+	void * ret;
+	if (nsize == 0) {
+		if (ptr) {
+			_pool_free(l->pool, ptr, osize);
+		}
+		ret = NULL;
+	} else if (ptr && _pool_class(osize) >= POOL_CLASS && _pool_class(nsize) >= POOL_CLASS) {
+		ret = realloc(ptr, nsize);
+		if (ret == NULL) {
+			if (nsize > osize) {
+				return NULL;
+			}
+			// lua doesn't expect a shrink to fail , keep the old block
+			ret = ptr;
+		}
+	} else if (ptr && _pool_class(osize) == _pool_class(nsize)) {
+		ret = ptr;
+	} else {
+		ret = _pool_alloc(l->pool, nsize);
+		if (ret == NULL) {
+			if (nsize > osize) {
+				return NULL;
+			}
+			// the old block is large enough for the class of nsize , it is freed as that class later
+			ret = ptr;
+		} else if (ptr) {
+			memcpy(ret, ptr, osize < nsize ? osize : nsize);
+			_pool_free(l->pool, ptr, osize);
+		}
+	}
+	l->mem = l->mem - osize + nsize;
+	if (l->mem > l->mem_report) {
+		l->mem_report *= 2;
+		skynet_error(l->ctx, "Memory warning %.2f M", (double)l->mem / (1024 * 1024));
+	}
+	return ret;
+}
+
+static int
+_panic(lua_State *L) {
+	fprintf(stderr, "snlua : unprotected error in call to lua api (%s)\n", lua_tostring(L, -1));
+	return 0;
+}
+
+static lua_State *
+_newstate(struct snlua *l) {
+	lua_State *L = lua_newstate(_lalloc, l);
+	if (L) {
+		lua_atpanic(L, _panic);
+	}
+	return L;
+}
+
+// config value in megabyte
+static size_t
+_optmb(const char * key, size_t opt) {
+	const char * v = skynet_command(NULL, "GETENV", key);
+	if (v == NULL) {
+		return opt;
+	}
+	return (size_t)strtoul(v, NULL, 10) * 1024 * 1024;
+}
+
 static int 
 traceback (lua_State *L) {
 	const char *msg = lua_tostring(L, 1);
@@ -125,6 +472,11 @@ snlua_init(struct snlua *l, struct skynet_context *ctx, const char * args) {
 	luaL_openlibs(L);
 	lua_pushlightuserdata(L, l);
 	lua_setfield(L, LUA_REGISTRYINDEX, "skynet_lua");
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, LUA_SEARCHERS);
+	lua_pushcfunction(L, _searcher);
+	lua_rawseti(L, -2, 2);
+	lua_pop(L, 2);
 	lua_gc(L, LUA_GCRESTART, 0);
 
 	char tmp[strlen(args)+1];
@@ -168,13 +520,23 @@ struct snlua *
 snlua_create(void) {
 	struct snlua * l = malloc(sizeof(*l));
 	memset(l,0,sizeof(*l));
-	l->L = luaL_newstate();
+	l->pool = malloc(sizeof(struct snlua_pool));
+	memset(l->pool, 0, sizeof(struct snlua_pool));
+	l->mem_limit = _optmb("lua_memlimit", 0);
+	l->mem_report = _optmb("lua_memwarning", MEMORY_WARNING_REPORT);
+	if (l->mem_report == 0) {
+		l->mem_report = MEMORY_WARNING_REPORT;
+	}
+	l->L = _newstate(l);
+	l->newstate = _newstate;
 	l->init = snlua_init;
+	l->clear_cache = _cache_clear;
 	return l;
 }
 
 void
 snlua_release(struct snlua *l) {
 	lua_close(l->L);
+	_pool_release(l->pool);
 	free(l);
 }
@@ -1,11 +1,21 @@
 #ifndef SKYNET_SERVICE_LUA_H
 #define SKYNET_SERVICE_LUA_H
 
+struct snlua_pool;
+
 struct snlua {
 	lua_State * L;
 	const char * reload;
 	struct skynet_context * ctx;
+	size_t mem;	// bytes allocated by lua
+	size_t mem_limit;	// allocation fails (LUA_ERRMEM) over it , 0 for unlimited
+	size_t mem_report;	// warn when mem is over it , then double it
+	struct snlua_pool * pool;
 	int (*init)(struct snlua *l, struct skynet_context *ctx, const char * args);
+	// new lua_State with the allocator of l
+	lua_State * (*newstate)(struct snlua *l);
+	// clear compiled chunks of all services , see service_lua.c
+	void (*clear_cache)(void);
 };
 
 #endif
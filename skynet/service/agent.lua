@@ -15,5 +15,7 @@ skynet.register_protocol {
 }
 
 skynet.start(function()
+	-- the client messages are copied to string by unpack , never kept
+	skynet.slice(true)
 	skynet.send(client,"text","Welcome to skynet")
 end)
@@ -48,6 +48,25 @@ function command.INFO(handle)
 	end
 end
 
+-- PROFILE handle count : start , PROFILE handle [filename] or PROFILE handle 0 : stop and dump collapsed stacks
+function command.PROFILE(handle, arg)
+	handle = handle_to_address(handle)
+	local count = tonumber(arg)
+	local text, samples = skynet.call(handle,"debug","PROFILE", count)
+	if count and count > 0 then
+		skynet.ret(skynet.pack({ [skynet.address(handle)] = "profile every " .. count .. " instructions" }))
+	elseif text == nil then
+		skynet.ret(skynet.pack({ [skynet.address(handle)] = "profile is off" }))
+	elseif arg and count == nil then
+		local f = assert(io.open(arg, "w"))
+		f:write(text, "\n")
+		f:close()
+		skynet.ret(skynet.pack({ [arg] = samples .. " samples" }))
+	else
+		skynet.ret(skynet.pack({ text }))
+	end
+end
+
 function command.KILL(handle)
 	handle = handle_to_address(handle)
 	skynet.kill(handle)
@@ -64,6 +83,10 @@ function command.MEM()
 	skynet.ret(skynet.pack(list))
 end
 
+function command.SLAB()
+	skynet.ret(skynet.pack(skynet.slab()))
+end
+
 function command.GC()
 	for k,v in pairs(services) do
 		skynet.send(k,"debug","GC")
@@ -10,6 +10,8 @@ skynet.start(function()
 	local watchdog = skynet.launch("snlua","watchdog","8888 4 0")
 	local db = skynet.launch("snlua","simpledb")
 --	skynet.launch("snlua","testgroup")
+--	skynet.launch("snlua","testslice")
+--	skynet.launch("snlua","testcoroutine")
 
 	skynet.exit()
 end)
@@ -0,0 +1,49 @@
+local skynet = require "skynet"
+
+-- A finished dispatch coroutine goes back to the pool (see co_create in skynet.lua) , so the requests
+-- handled one by one run in the same coroutine , and a warm service creates no coroutine for them.
+-- It prints the calls per second and the lua memory of the slave as the measurement of the pool.
+
+local mode = ...
+
+local N = 100000
+
+if mode == "slave" then
+	local create = coroutine.create
+	local created = 0
+	coroutine.create = function(f)
+		created = created + 1
+		return create(f)
+	end
+	skynet.start(function()
+		skynet.dispatch("lua", function(session, address, cmd)
+			if cmd == "RUNNING" then
+				skynet.ret(skynet.pack(tostring(coroutine.running())))
+			elseif cmd == "CREATED" then
+				skynet.ret(skynet.pack(created, collectgarbage "count"))
+			else
+				skynet.ret(skynet.pack(cmd))
+			end
+		end)
+	end)
+	return
+end
+
+skynet.start(function()
+	local slave = skynet.newservice("testcoroutine", "slave")
+	local co1 = skynet.call(slave, "lua", "RUNNING")
+	local co2 = skynet.call(slave, "lua", "RUNNING")
+	assert(co1 == co2, "the dispatch coroutine is not reused")
+	local c0 = skynet.call(slave, "lua", "CREATED")
+	local t = skynet.now()
+	for i=1,N do
+		skynet.call(slave, "lua", "PING")
+	end
+	t = skynet.now() - t
+	local c1, mem = skynet.call(slave, "lua", "CREATED")
+	print(string.format("coroutine : %d calls in %d cs (%.0f/s) , %d coroutines created , slave lua memory %.0f KB",
+		N, t, N * 100 / math.max(t, 1), c1 - c0, mem))
+	assert(c1 == c0, "coroutines are created for the calls")
+	skynet.kill(slave)
+	skynet.exit()
+end)
@@ -0,0 +1,56 @@
+local skynet = require "skynet"
+local group = require "mcgroup"
+
+-- A member with "drop" policy is kept busy while the group is flooded , so it drops multicasts
+-- shared with another member. Both members check every message they get.
+
+local mode, limit = ...
+
+local N = 1000
+
+if mode == "member" then
+	local count = 0
+	skynet.start(function()
+		skynet.dispatch("text", function(session, address, text)
+			local i = tonumber(string.match(text, "^multicast (%d+)$"))
+			assert(i and i >= 1 and i <= N, text)
+			count = count + 1
+		end)
+		skynet.dispatch("lua", function(session, address, cmd)
+			if cmd == "BUSY" then
+				local t = os.clock()
+				while os.clock() - t < 1 do end
+			elseif cmd == "COUNT" then
+				skynet.ret(skynet.pack(count))
+			end
+		end)
+		limit = tonumber(limit)
+		if limit > 0 then
+			skynet.mailbox(limit, "drop")
+		end
+	end)
+	return
+end
+
+skynet.start(function()
+	local gid = group.create()
+	local gaddr = group.address(gid)
+	local drop = skynet.newservice("testmcdrop", "member", "8")
+	local all = skynet.newservice("testmcdrop", "member", "0")
+	group.enter(gid, drop)
+	group.enter(gid, all)
+	skynet.sleep(10)
+	skynet.send(drop, "lua", "BUSY")
+	for i=1,N do
+		skynet.send(gaddr, "text", "multicast " .. i)
+	end
+	skynet.sleep(200)
+	local n_drop = skynet.call(drop, "lua", "COUNT")
+	local n_all = skynet.call(all, "lua", "COUNT")
+	print(string.format("multicast drop : %d of %d received with limit 8 , %d without limit", n_drop, N, n_all))
+	assert(n_drop < N and n_all == N)
+	group.release(gid)
+	skynet.kill(drop)
+	skynet.kill(all)
+	skynet.exit()
+end)
@@ -0,0 +1,92 @@
+local skynet = require "skynet"
+local socket = require "socket"
+
+-- A gate with slice option forwards the packages of two clients to two agents. The "keep" agent
+-- keeps every message by skynet.ref and checks them later , so it must get copies. The "slice"
+-- agent turns on skynet.slice and reads the messages in dispatch.
+
+local mode = ...
+
+local port = 8867
+local N = 1000
+
+skynet.register_protocol {
+	name = "client",
+	id = 3,
+	unpack = function(msg, sz) return msg, sz end,
+}
+
+if mode == "keep" then
+	local kept = {}
+	skynet.start(function()
+		skynet.dispatch("client", function(session, address, msg, sz)
+			table.insert(kept, { skynet.ref(msg), sz })
+		end)
+		skynet.dispatch("lua", function(session, address, cmd)
+			assert(cmd == "CHECK")
+			for i, v in ipairs(kept) do
+				assert(skynet.tostring(v[1], v[2]) == "package " .. i)
+				skynet.unref(v[1])
+			end
+			skynet.ret(skynet.pack(#kept))
+			kept = {}
+		end)
+	end)
+	return
+end
+
+if mode == "slice" then
+	local count = 0
+	skynet.start(function()
+		assert(skynet.slice(true))
+		skynet.dispatch("client", function(session, address, msg, sz)
+			count = count + 1
+			assert(skynet.tostring(msg, sz) == "package " .. count)
+		end)
+		skynet.dispatch("lua", function(session, address, cmd)
+			assert(cmd == "CHECK")
+			skynet.ret(skynet.pack(count))
+		end)
+	end)
+	return
+end
+
+if mode == "client" then
+	skynet.start(function()
+		assert(not socket.connect("127.0.0.1:" .. port), "connect failed")
+		for i=1,N do
+			socket.writeblock(2, "package " .. i)
+		end
+	end)
+	return
+end
+
+skynet.start(function()
+	local agents = { skynet.newservice("testslice", "keep"), skynet.newservice("testslice", "slice") }
+	local opened = 0
+	local gate
+	skynet.dispatch("text", function(session, from, message)
+		local fd, cmd = string.match(message, "(%d+) (%w+)")
+		if cmd == "open" then
+			opened = opened + 1
+			skynet.send(gate, "text", "forward", fd, skynet.address(agents[opened]), skynet.address(agents[opened]))
+		end
+	end)
+	-- header watchdog port client_tag max_connection max_buffer max_send cork reuseport slice
+	gate = skynet.launch("gate", "S", skynet.address(skynet.self()), port, 0, 16, 0, 0, 0, 0, 1)
+	skynet.send(gate, "text", "start")
+	local clients = { skynet.newservice("testslice", "client"), skynet.newservice("testslice", "client") }
+	skynet.sleep(200)
+	local n_keep = skynet.call(agents[1], "lua", "CHECK")
+	local n_slice = skynet.call(agents[2], "lua", "CHECK")
+	print(string.format("slice : keep agent %d , slice agent %d of %d packages", n_keep, n_slice, N))
+	assert(n_keep == N and n_slice == N)
+	for _, v in ipairs(clients) do
+		skynet.kill(v)
+	end
+	skynet.kill(gate)
+	for _, v in ipairs(agents) do
+		skynet.kill(v)
+	end
+	skynet.exit()
+end)
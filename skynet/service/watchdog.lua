@@ -1,11 +1,12 @@
 local skynet = require "skynet"
 
-local port, max_agent, buffer = ...
+local port, max_agent, buffer, shard = ...
 local command = {}
 local agent_all = {}
-local gate
+-- gates (shards) listening on the same port , the connection belongs to the one reported open
+local gate_all = {}
 
-function command:open(parm)
+function command:open(parm, session, gate)
 	local fd,addr = string.match(parm,"(%d+) ([^%s]+)")
 	fd = tonumber(fd)
 	print("agent open",self,string.format("%d %d %s",self,fd,addr))
@@ -46,13 +47,22 @@ skynet.start(function()
 		id = tonumber(id)
 		local f = command[cmd]
 		if f then
-			f(id,parm,session)
+			f(id,parm,session,from)
 		else
 			error(string.format("[watchdog] Unknown command : %s",message))
 		end
 	end)
-	-- 0 for default client tag
-	gate = skynet.launch("gate" , "S" , skynet.address(skynet.self()), port, 0, max_agent, buffer)
-	skynet.send(gate,"text", "start")
+	shard = tonumber(shard) or 1
+	-- 0 for default client tag , max_send 0 , cork 0 , reuseport 1 when sharded
+	-- each shard accepts max_agent connections
+	local reuseport = shard > 1 and 1 or 0
+	for i=1,shard do
+		local gate = skynet.launch("gate" , "S" , skynet.address(skynet.self()), port, 0, max_agent, buffer, 0, 0, reuseport)
+		assert(gate, "launch gate failed")
+		table.insert(gate_all, gate)
+	end
+	for _,gate in ipairs(gate_all) do
+		skynet.send(gate,"text", "start")
+	end
 	skynet.register(".watchdog")
 end)
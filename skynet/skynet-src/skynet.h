@@ -10,6 +10,10 @@
 #define PTYPE_CLIENT 3
 #define PTYPE_SYSTEM 4
 #define PTYPE_HARBOR 5
+// event of socket thread , see skynet_socket.h
+#define PTYPE_SOCKET 6
+// error response , the request is dropped because the mailbox of destination is full
+#define PTYPE_ERROR 7
 #define PTYPE_TAG_DONTCOPY 0x10000
 #define PTYPE_TAG_ALLOCSESSION 0x20000
 
@@ -18,12 +22,43 @@ struct skynet_context;
 void skynet_error(struct skynet_context * context, const char *msg, ...);
 const char * skynet_command(struct skynet_context * context, const char * cmd , const char * parm);
 uint32_t skynet_queryname(struct skynet_context * context, const char * name);
+// return session , -1 if destination is invalid , -2 if mailbox of destination is full and the message
+// has no session (a request gets a PTYPE_ERROR response instead)
 int skynet_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * msg, size_t sz);
 int skynet_sendname(struct skynet_context * context, const char * destination , int type, int session, void * msg, size_t sz);
+// send sz bytes at msg inside block (allocated by skynet_malloc) without copy. The message holds a
+// reference of block (see skynet_ref) , released after the callback of destination returns.
+// Only the destination turned on by command SLICE gets msg itself , it can't keep msg (return 1 or
+// skynet_ref) and the payload is not zero terminated. Others get a copy , and it's copied for remote.
+int skynet_send_slice(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * block, const void * msg, size_t sz);
+
+// typed version of the hot commands , avoid parsing and formatting strings.
+// time of TIMEOUT is centisecond , return the session of the response , -1 for error
+int skynet_timeout_session(struct skynet_context * context, int time);
+// time is millisecond
+int skynet_timeout_session_ms(struct skynet_context * context, int time);
+// return 0 if the timer of session is cancelled , -1 if it has expired
+int skynet_cancel(struct skynet_context * context, int session);
+uint32_t skynet_self(struct skynet_context * context);
+// centisecond since start
+uint32_t skynet_now(void);
+uint64_t skynet_now_ms(void);
+// start time in second
+uint32_t skynet_starttime(void);
 
 void skynet_forward(struct skynet_context *, uint32_t destination);
+// 1 if the mailbox of handle is over its limit , the sender should slow down
+int skynet_overload(uint32_t handle);
 int skynet_isremote(struct skynet_context *, uint32_t handle, int * harbor);
 
+// message payload sent without PTYPE_TAG_DONTCOPY is allocated by skynet_malloc ,
+// and the payload passed with PTYPE_TAG_DONTCOPY should be allocated by it too.
+void * skynet_malloc(size_t sz);
+void skynet_free(void *ptr);
+// add n holders to a block allocated by skynet_malloc , so it can be sent (with PTYPE_TAG_DONTCOPY)
+// or kept by n+1 holders without copy. Each holder releases it by skynet_free.
+void skynet_ref(void *ptr, int n);
+
 typedef int (*skynet_cb)(struct skynet_context * context, void *ud, int type, int session, uint32_t source , const void * msg, size_t sz);
 void skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb);
 
@@ -38,8 +38,13 @@ skynet_error(struct skynet_context * context, const char *msg, ...) {
 		smsg.source = skynet_context_handle(context);
 	}
 	smsg.session = 0;
-	smsg.data = strdup(tmp);
+	smsg.data = skynet_malloc(len + 1);
+	memcpy(smsg.data, tmp, len + 1);
+	smsg.offset = 0;
 	smsg.sz = len | (PTYPE_TEXT << HANDLE_REMOTE_SHIFT);
-	skynet_context_push(logger, &smsg);
+	if (skynet_context_push(logger, &smsg)) {
+		// the logger is gone or its mailbox is full
+		skynet_free(smsg.data);
+	}
 }
 
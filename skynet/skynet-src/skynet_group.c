@@ -71,7 +71,7 @@ skynet_group_query(int handle) {
 
 static void
 send_command(struct skynet_context *ctx, const char * cmd, uint32_t node) {
-	char * tmp = malloc(16);
+	char * tmp = skynet_malloc(16);
 	int n = sprintf(tmp, "%s %x", cmd, node);
 	skynet_context_send(ctx, tmp, n+1 , 0, PTYPE_SYSTEM, 0);
 }
@@ -128,7 +128,7 @@ skynet_group_clear(int handle) {
 		if (node->handle == handle) {
 			struct skynet_context * ctx = node->ctx;
 			
-			char * cmd = malloc(8);
+			char * cmd = skynet_malloc(8);
 			int n = sprintf(cmd, "C");
 			skynet_context_send(ctx, cmd, n+1, 0 , PTYPE_SYSTEM, 0);
 			*pnode = node->next;
@@ -8,26 +8,99 @@
 
 #define DEFAULT_SLOT_SIZE 4
 
+#define DEFAULT_NAME_CAP 16
+#define NAME_VERSION_SIZE 256
+
+// names are kept in a hash table , and also linked by owner slot (handle & (owner_size-1)) ,
+// so retire removes the names of a handle without scanning all names.
+
 struct handle_name {
+	struct handle_name * next;
+	struct handle_name * next_owner;
 	char * name;
+	uint32_t hash;
 	uint32_t handle;
 };
 
+// slot array is replaced as a whole when it grows , so a reader always sees a matching size
+
+struct handle_slot {
+	struct handle_slot * prev;
+	int size;
+	struct skynet_context * volatile ctx[1];
+};
+
 struct handle_storage {
+	// write lock for slot and name , read lock for name only
 	struct rwlock lock;
 
 	uint32_t harbor;
 	uint32_t handle_index;
-	int slot_size;
-	struct skynet_context ** slot;
+	struct handle_slot * volatile slot;
 	
 	int name_cap;
 	int name_count;
-	struct handle_name *name;
+	struct handle_name ** name;
+	int owner_size;
+	struct handle_name ** owner;
+	// bumped when a name of the stripe is removed , see skynet_handle_findname_cache
+	volatile uint32_t version[NAME_VERSION_SIZE];
 };
 
 static struct handle_storage *H = NULL;
 
+static struct handle_slot *
+_new_slot(int size) {
+	size_t sz = sizeof(struct handle_slot) + (size - 1) * sizeof(struct skynet_context *);
+	struct handle_slot * slot = malloc(sz);
+	memset(slot, 0, sz);
+	slot->size = size;
+	return slot;
+}
+
+static void
+_expand_owner(struct handle_storage *s, int size) {
+	struct handle_name ** o = malloc(size * sizeof(struct handle_name *));
+	memset(o, 0, size * sizeof(struct handle_name *));
+	int i;
+	for (i=0;i<s->owner_size;i++) {
+		struct handle_name * n = s->owner[i];
+		while (n) {
+			struct handle_name * next = n->next_owner;
+			struct handle_name ** owner = &o[n->handle & (size-1)];
+			n->next_owner = *owner;
+			*owner = n;
+			n = next;
+		}
+	}
+	free(s->owner);
+	s->owner = o;
+	s->owner_size = size;
+}
+
+// remove all names of handle , O(names in the same owner slot)
+static void
+_remove_name(struct handle_storage *s, uint32_t handle) {
+	struct handle_name ** owner = &s->owner[handle & (s->owner_size-1)];
+	while (*owner) {
+		struct handle_name * n = *owner;
+		if (n->handle != handle) {
+			owner = &n->next_owner;
+			continue;
+		}
+		*owner = n->next_owner;
+		struct handle_name ** bucket = &s->name[n->hash & (s->name_cap-1)];
+		while (*bucket != n) {
+			bucket = &(*bucket)->next;
+		}
+		*bucket = n->next;
+		--s->name_count;
+		__sync_add_and_fetch(&s->version[n->hash % NAME_VERSION_SIZE], 1);
+		free(n->name);
+		free(n);
+	}
+}
+
 uint32_t
 skynet_handle_register(struct skynet_context *ctx) {
 	struct handle_storage *s = H;
@@ -35,32 +108,35 @@ skynet_handle_register(struct skynet_context *ctx) {
 	rwlock_wlock(&s->lock);
 	
 	for (;;) {
+		struct handle_slot * slot = s->slot;
 		int i;
-		for (i=0;i<s->slot_size;i++) {
+		for (i=0;i<slot->size;i++) {
 			uint32_t handle = (i+s->handle_index) & HANDLE_MASK;
-			int hash = handle & (s->slot_size-1);
-			if (s->slot[hash] == NULL) {
-				s->slot[hash] = ctx;
+			int hash = handle & (slot->size-1);
+			if (slot->ctx[hash] == NULL) {
 				s->handle_index = handle + 1;
-
-				rwlock_wunlock(&s->lock);
-
 				handle |= s->harbor;
+				// init handle before publish , skynet_handle_grab checks it
 				skynet_context_init(ctx, handle);
+				__sync_synchronize();
+				slot->ctx[hash] = ctx;
+
+				rwlock_wunlock(&s->lock);
 				return handle;
 			}
 		}
-		assert((s->slot_size*2 - 1) <= HANDLE_MASK);
-		struct skynet_context ** new_slot = malloc(s->slot_size * 2 * sizeof(struct skynet_context *));
-		memset(new_slot, 0, s->slot_size * 2 * sizeof(struct skynet_context *));
-		for (i=0;i<s->slot_size;i++) {
-			int hash = skynet_context_handle(s->slot[i]) & (s->slot_size * 2 - 1);
-			assert(new_slot[hash] == NULL);
-			new_slot[hash] = s->slot[i];
+		assert((slot->size*2 - 1) <= HANDLE_MASK);
+		struct handle_slot * new_slot = _new_slot(slot->size * 2);
+		for (i=0;i<slot->size;i++) {
+			int hash = skynet_context_handle(slot->ctx[i]) & (new_slot->size - 1);
+			assert(new_slot->ctx[hash] == NULL);
+			new_slot->ctx[hash] = slot->ctx[i];
 		}
-		free(s->slot);
+		// readers may still use the old slot , keep it
+		new_slot->prev = slot;
+		__sync_synchronize();
 		s->slot = new_slot;
-		s->slot_size *= 2;
+		_expand_owner(s, new_slot->size);
 	}
 }
 
@@ -70,24 +146,14 @@ skynet_handle_retire(uint32_t handle) {
 
 	rwlock_wlock(&s->lock);
 
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
+	struct handle_slot * slot = s->slot;
+	uint32_t hash = handle & (slot->size-1);
+	struct skynet_context * ctx = slot->ctx[hash];
 
 	if (ctx != NULL && skynet_context_handle(ctx) == handle) {
+		slot->ctx[hash] = NULL;
 		skynet_context_release(ctx);
-		s->slot[hash] = NULL;
-		int i;
-		int j=0, n=s->name_count;
-		for (i=0; i<n; ++i) {
-			if (s->name[i].handle == handle) {
-				free(s->name[i].name);
-				continue;
-			} else if (i!=j) {
-				s->name[j] = s->name[i];
-			}
-			++j;
-		}
-		s->name_count = j;
+		_remove_name(s, handle);
 	}
 
 	rwlock_wunlock(&s->lock);
@@ -99,10 +165,9 @@ skynet_handle_retireall() {
 	for (;;) {
 		int n=0;
 		int i;
-		for (i=0;i<s->slot_size;i++) {
-			rwlock_rlock(&s->lock);
-			struct skynet_context * ctx = s->slot[i];
-			rwlock_runlock(&s->lock);
+		struct handle_slot * slot = s->slot;
+		for (i=0;i<slot->size;i++) {
+			struct skynet_context * ctx = slot->ctx[i];
 			if (ctx != NULL) {
 				++n;
 				skynet_handle_retire(skynet_context_handle(ctx));
@@ -113,102 +178,131 @@ skynet_handle_retireall() {
 	}
 }
 
+// lock free , the slot array is never freed and a context is never returned to malloc ,
+// skynet_context_grab fails if the context is deleted or reused by another handle.
 struct skynet_context * 
 skynet_handle_grab(uint32_t handle) {
+	struct handle_slot * slot = H->slot;
+	struct skynet_context * ctx = slot->ctx[handle & (slot->size-1)];
+	if (ctx == NULL) {
+		return NULL;
+	}
+	return skynet_context_grab(ctx, handle);
+}
+
+static inline uint32_t
+_hash_name(const char * name, size_t *len) {
+	size_t l = strlen(name);
+	uint32_t h = (uint32_t)l;
+	size_t i;
+	for (i=0;i<l;i++) {
+		h = h ^ ((h<<5) + (h>>2) + (uint8_t)name[i]);
+	}
+	*len = l;
+	return h;
+}
+
+static uint32_t
+_find_name(struct handle_storage *s, const char * name, uint32_t hash) {
+	struct handle_name * n = s->name[hash & (s->name_cap-1)];
+	while (n) {
+		if (n->hash == hash && strcmp(n->name, name) == 0) {
+			return n->handle;
+		}
+		n = n->next;
+	}
+	return 0;
+}
+
+uint32_t 
+skynet_handle_findname(const char * name) {
 	struct handle_storage *s = H;
-	struct skynet_context * result = NULL;
+	size_t len;
+	uint32_t hash = _hash_name(name, &len);
 
 	rwlock_rlock(&s->lock);
 
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
-	if (ctx && skynet_context_handle(ctx) == handle) {
-		result = ctx;
-		skynet_context_grab(result);
-	}
+	uint32_t handle = _find_name(s, name, hash);
 
 	rwlock_runlock(&s->lock);
 
-	return result;
+	return handle;
 }
 
-uint32_t 
-skynet_handle_findname(const char * name) {
+uint32_t
+skynet_handle_findname_cache(const char * name, struct skynet_name_cache cache[NAME_CACHE_SIZE]) {
 	struct handle_storage *s = H;
+	size_t len;
+	uint32_t hash = _hash_name(name, &len);
+	if (len >= NAME_CACHE_LENGTH) {
+		return skynet_handle_findname(name);
+	}
+	struct skynet_name_cache * c = &cache[hash % NAME_CACHE_SIZE];
+	// read version before lookup , retire bumps it after the name is removed
+	uint32_t version = s->version[hash % NAME_VERSION_SIZE];
+	if (c->version == version && c->hash == hash && memcmp(c->name, name, len+1) == 0) {
+		return c->handle;
+	}
 
 	rwlock_rlock(&s->lock);
 
-	uint32_t handle = 0;
-
-	int begin = 0;
-	int end = s->name_count - 1;
-	while (begin<=end) {
-		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
-		int c = strcmp(n->name, name);
-		if (c==0) {
-			handle = n->handle;
-			break;
-		}
-		if (c<0) {
-			begin = mid + 1;
-		} else {
-			end = mid - 1;
-		}
-	}
+	uint32_t handle = _find_name(s, name, hash);
 
 	rwlock_runlock(&s->lock);
 
+	if (handle) {
+		c->version = version;
+		c->hash = hash;
+		c->handle = handle;
+		memcpy(c->name, name, len+1);
+	}
 	return handle;
 }
 
 static void
-_insert_name_before(struct handle_storage *s, char *name, uint32_t handle, int before) {
-	if (s->name_count >= s->name_cap) {
-		s->name_cap *= 2;
-		struct handle_name * n = malloc(s->name_cap * sizeof(struct handle_name));
-		int i;
-		for (i=0;i<before;i++) {
-			n[i] = s->name[i];
-		}
-		for (i=before;i<s->name_count;i++) {
-			n[i+1] = s->name[i];
-		}
-		free(s->name);
-		s->name = n;
-	} else {
-		int i;
-		for (i=s->name_count;i>before;i--) {
-			s->name[i] = s->name[i-1];
+_expand_name(struct handle_storage *s) {
+	int cap = s->name_cap * 2;
+	struct handle_name ** n = malloc(cap * sizeof(struct handle_name *));
+	memset(n, 0, cap * sizeof(struct handle_name *));
+	int i;
+	for (i=0;i<s->name_cap;i++) {
+		struct handle_name * node = s->name[i];
+		while (node) {
+			struct handle_name * next = node->next;
+			struct handle_name ** bucket = &n[node->hash & (cap-1)];
+			node->next = *bucket;
+			*bucket = node;
+			node = next;
 		}
 	}
-	s->name[before].name = name;
-	s->name[before].handle = handle;
-	s->name_count ++;
+	free(s->name);
+	s->name = n;
+	s->name_cap = cap;
 }
 
 static const char *
 _insert_name(struct handle_storage *s, const char * name, uint32_t handle) {
-	int begin = 0;
-	int end = s->name_count - 1;
-	while (begin<=end) {
-		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
-		int c = strcmp(n->name, name);
-		if (c==0) {
-			return NULL;
-		}
-		if (c<0) {
-			begin = mid + 1;
-		} else {
-			end = mid - 1;
-		}
+	size_t len;
+	uint32_t hash = _hash_name(name, &len);
+	if (_find_name(s, name, hash)) {
+		return NULL;
 	}
-	char * result = strdup(name);
-
-	_insert_name_before(s, result, handle, begin);
-
-	return result;
+	if (s->name_count >= s->name_cap) {
+		_expand_name(s);
+	}
+	struct handle_name * n = malloc(sizeof(*n));
+	n->name = strdup(name);
+	n->hash = hash;
+	n->handle = handle;
+	struct handle_name ** bucket = &s->name[hash & (s->name_cap-1)];
+	n->next = *bucket;
+	*bucket = n;
+	struct handle_name ** owner = &s->owner[handle & (s->owner_size-1)];
+	n->next_owner = *owner;
+	*owner = n;
+	++s->name_count;
+
+	return n->name;
 }
 
 const char * 
@@ -226,17 +320,23 @@ void
 skynet_handle_init(int harbor) {
 	assert(H==NULL);
 	struct handle_storage * s = malloc(sizeof(*H));
-	s->slot_size = DEFAULT_SLOT_SIZE;
-	s->slot = malloc(s->slot_size * sizeof(struct skynet_context *));
-	memset(s->slot, 0, s->slot_size * sizeof(struct skynet_context *));
+	s->slot = _new_slot(DEFAULT_SLOT_SIZE);
 
 	rwlock_init(&s->lock);
 	// reserve 0 for system
 	s->harbor = (uint32_t) (harbor & 0xff) << HANDLE_REMOTE_SHIFT;
 	s->handle_index = 1;
-	s->name_cap = 2;
+	s->name_cap = DEFAULT_NAME_CAP;
 	s->name_count = 0;
-	s->name = malloc(s->name_cap * sizeof(struct handle_name));
+	s->name = malloc(s->name_cap * sizeof(struct handle_name *));
+	memset(s->name, 0, s->name_cap * sizeof(struct handle_name *));
+	s->owner_size = 0;
+	s->owner = NULL;
+	_expand_owner(s, DEFAULT_SLOT_SIZE);
+	int i;
+	for (i=0;i<NAME_VERSION_SIZE;i++) {
+		s->version[i] = 1;
+	}
 
 	H = s;
 
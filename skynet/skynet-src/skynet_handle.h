@@ -13,6 +13,20 @@ struct skynet_context * skynet_handle_grab(uint32_t handle);
 void skynet_handle_retireall();
 
 uint32_t skynet_handle_findname(const char * name);
+
+#define NAME_CACHE_SIZE 8
+#define NAME_CACHE_LENGTH 32
+
+// per context lookup cache , name longer than NAME_CACHE_LENGTH-1 is not cached
+struct skynet_name_cache {
+	uint32_t version;
+	uint32_t hash;
+	uint32_t handle;
+	char name[NAME_CACHE_LENGTH];
+};
+
+// cache is an array of NAME_CACHE_SIZE , it must not be shared by threads
+uint32_t skynet_handle_findname_cache(const char * name, struct skynet_name_cache cache[NAME_CACHE_SIZE]);
 const char * skynet_handle_namehandle(uint32_t handle, const char *name);
 
 void skynet_handle_init(int harbor);
@@ -10,6 +10,13 @@ struct skynet_config {
 	const char * local;
 	const char * start;
 	const char * standalone;
+	const char * scheduler;
+	const char * drain;
+	const char * mailbox;
+	const char * affinity;
+	const char * socket;
+	int tick;
+	int stat;
 };
 
 void skynet_start(struct skynet_config * config);
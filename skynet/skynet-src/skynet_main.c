@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
@@ -78,6 +79,8 @@ main(int argc, char *argv[]) {
 		config_file = argv[1];
 	}
 	skynet_env_init();
+	// write to a closed socket returns EPIPE instead
+	signal(SIGPIPE, SIG_IGN);
 
 	struct skynet_config config;
 
@@ -109,6 +112,13 @@ main(int argc, char *argv[]) {
 	config.start = optstring("start","main.lua");
 	config.local = optstring("address","127.0.0.1:2525");
 	config.standalone = optstring("standalone",NULL);
+	config.scheduler = optstring("scheduler","global");
+	config.drain = optstring("drain",NULL);
+	config.mailbox = optstring("mailbox",NULL);
+	config.affinity = optstring("affinity",NULL);
+	config.socket = optstring("socket",NULL);
+	config.tick = optint("tick",10000);
+	config.stat = optint("stat",0);
 
 	lua_close(L);
 
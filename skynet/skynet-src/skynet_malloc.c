@@ -0,0 +1,219 @@
+#include "skynet.h"
+#include "skynet_malloc.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// Size class i holds blocks of (16 << i) bytes , larger blocks go to malloc directly.
+// Each thread caches free blocks of any thread in its own heap , so a message freed by the
+// receiver is reused by the receiver's next send without any lock. When a thread caches too
+// many blocks of one class , it moves a batch to the global depot , and a thread that runs out
+// of blocks takes a batch back from the depot before carving a new page.
+// A block can be shared by skynet_ref , then it's released by the last skynet_free.
+
+#define SLAB_CLASS 8
+#define SLAB_MIN_SHIFT 4
+#define SLAB_PAGE (64 * 1024)
+#define SLAB_BATCH 64
+
+struct block {
+	int class;
+	int ref;	// 0 for not shared , or the number of holders
+};
+
+// header before each block , keep the block 16 bytes aligned
+#define HEADER_SIZE 16
+
+struct depot {
+	int lock;
+	void * batch;
+};
+
+struct heap {
+	struct heap * next;
+	void * freelist[SLAB_CLASS];
+	int cache[SLAB_CLASS];
+	char * page;
+	size_t page_left;
+	// counters of this thread , read by skynet_malloc_stat without lock
+	uint64_t alloc[SLAB_CLASS+1];
+	uint64_t release[SLAB_CLASS+1];
+	uint64_t carve[SLAB_CLASS];
+};
+
+#define HEADER(ptr) ((struct block *)((char *)(ptr) - HEADER_SIZE))
+#define NEXT(ptr) (((void **)(ptr))[0])
+#define NEXT_BATCH(ptr) (((void **)(ptr))[1])
+
+#define LOCK(q) while (__sync_lock_test_and_set(&(q)->lock,1)) {}
+#define UNLOCK(q) __sync_lock_release(&(q)->lock);
+
+static struct depot D[SLAB_CLASS];
+static struct heap * volatile HEAPS = NULL;
+static __thread struct heap * H = NULL;
+
+static struct heap *
+_heap(void) {
+	struct heap * h = H;
+	if (h) {
+		return h;
+	}
+	h = malloc(sizeof(*h));
+	memset(h, 0, sizeof(*h));
+	do {
+		h->next = HEAPS;
+	} while (!__sync_bool_compare_and_swap(&HEAPS, h->next, h));
+	H = h;
+	return h;
+}
+
+static inline int
+_class(size_t sz) {
+	int c = 0;
+	size_t s = 1 << SLAB_MIN_SHIFT;
+	while (s < sz) {
+		s <<= 1;
+		if (++c >= SLAB_CLASS) {
+			break;
+		}
+	}
+	return c;
+}
+
+static void *
+_carve(struct heap *h, int class) {
+	size_t sz = HEADER_SIZE + ((size_t)1 << (class + SLAB_MIN_SHIFT));
+	if (h->page_left < sz) {
+		// the rest of the old page is wasted , it's less than one block of the largest class
+		h->page = malloc(SLAB_PAGE);
+		h->page_left = SLAB_PAGE;
+	}
+	char * ptr = h->page + HEADER_SIZE;
+	h->page += sz;
+	h->page_left -= sz;
+	++h->carve[class];
+	HEADER(ptr)->class = class;
+	HEADER(ptr)->ref = 0;
+	return ptr;
+}
+
+static void
+_refill(struct heap *h, int class) {
+	struct depot * d = &D[class];
+	if (d->batch == NULL) {
+		return;
+	}
+	LOCK(d)
+	void * batch = d->batch;
+	if (batch) {
+		d->batch = NEXT_BATCH(batch);
+	}
+	UNLOCK(d)
+	if (batch) {
+		h->freelist[class] = batch;
+		h->cache[class] = SLAB_BATCH;
+	}
+}
+
+static void
+_flush(struct heap *h, int class) {
+	// move the first SLAB_BATCH blocks to depot
+	void * batch = h->freelist[class];
+	void * last = batch;
+	int i;
+	for (i=1;i<SLAB_BATCH;i++) {
+		last = NEXT(last);
+	}
+	h->freelist[class] = NEXT(last);
+	h->cache[class] -= SLAB_BATCH;
+	NEXT(last) = NULL;
+
+	struct depot * d = &D[class];
+	LOCK(d)
+	NEXT_BATCH(batch) = d->batch;
+	d->batch = batch;
+	UNLOCK(d)
+}
+
+void *
+skynet_malloc(size_t sz) {
+	struct heap * h = _heap();
+	int class = _class(sz);
+	void * ptr;
+	if (class >= SLAB_CLASS) {
+		ptr = (char *)malloc(HEADER_SIZE + sz) + HEADER_SIZE;
+		HEADER(ptr)->class = SLAB_CLASS;
+		HEADER(ptr)->ref = 0;
+	} else {
+		if (h->freelist[class] == NULL) {
+			_refill(h, class);
+		}
+		ptr = h->freelist[class];
+		if (ptr) {
+			h->freelist[class] = NEXT(ptr);
+			-- h->cache[class];
+		} else {
+			ptr = _carve(h, class);
+		}
+	}
+	++h->alloc[HEADER(ptr)->class];
+	return ptr;
+}
+
+void
+skynet_free(void *ptr) {
+	if (ptr == NULL) {
+		return;
+	}
+	struct block * b = HEADER(ptr);
+	if (b->ref && __sync_sub_and_fetch(&b->ref, 1) != 0) {
+		// other holders of the shared block
+		return;
+	}
+	struct heap * h = _heap();
+	int class = b->class;
+	++h->release[class];
+	if (class == SLAB_CLASS) {
+		free(HEADER(ptr));
+		return;
+	}
+	NEXT(ptr) = h->freelist[class];
+	h->freelist[class] = ptr;
+	if (++h->cache[class] >= SLAB_BATCH * 2) {
+		_flush(h, class);
+	}
+}
+
+void
+skynet_ref(void *ptr, int n) {
+	if (ptr == NULL || n <= 0) {
+		return;
+	}
+	struct block * b = HEADER(ptr);
+	// the receivers of a multicast payload may add holders at the same time
+	if (b->ref != 0 || !__sync_bool_compare_and_swap(&b->ref, 0, 1 + n)) {
+		__sync_add_and_fetch(&b->ref, n);
+	}
+}
+
+int
+skynet_malloc_stat(int class, struct skynet_malloc_stat *stat) {
+	if (class < 0 || class > SLAB_CLASS) {
+		return 1;
+	}
+	stat->size = class == SLAB_CLASS ? 0 : (size_t)1 << (class + SLAB_MIN_SHIFT);
+	stat->alloc = 0;
+	stat->inuse = 0;
+	stat->carve = 0;
+	struct heap * h = HEAPS;
+	while (h) {
+		stat->alloc += h->alloc[class];
+		stat->inuse += h->alloc[class] - h->release[class];
+		if (class < SLAB_CLASS) {
+			stat->carve += h->carve[class];
+		}
+		h = h->next;
+	}
+	return 0;
+}
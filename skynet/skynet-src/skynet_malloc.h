@@ -0,0 +1,17 @@
+#ifndef SKYNET_MALLOC_H
+#define SKYNET_MALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct skynet_malloc_stat {
+	size_t size;	// block size of the class , 0 for large block
+	uint64_t alloc;
+	uint64_t inuse;
+	uint64_t carve;	// blocks carved from slab pages
+};
+
+// class from 0 , return 1 if class is out of range
+int skynet_malloc_stat(int class, struct skynet_malloc_stat *stat);
+
+#endif
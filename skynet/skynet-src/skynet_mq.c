@@ -8,9 +8,12 @@
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
 
-#define DEFAULT_QUEUE_SIZE 64;
+#define MQ_CHUNK_SIZE 64
 #define MAX_GLOBAL_MQ 0x10000
+#define DEFAULT_LOCAL_QUEUE 256
 
 // 0 means mq is not in global mq.
 // 1 means mq is in global mq , or the message is dispatching.
@@ -21,16 +24,69 @@
 #define MQ_DISPATCHING 2
 #define MQ_LOCKED 3
 
+// The mailbox is a list of chunks , many producers and one consumer (the worker owns the queue).
+// Producers take a slot by atomic add on the tail chunk , when the chunk is full they race to
+// link a new one , and anyone may move the tail forward. Consumed chunks are freed when no
+// producer may still touch them , so the mailbox shrinks after a burst.
+// A producer counts itself in producers[gen] while it may hold a chunk. The consumer retires chunks
+// to a list , flips gen , and frees that list once producers of the old generation are all gone.
+// So a mailbox under continuous sends frees its chunks too , it needs no moment without producer.
+// Each mailbox has two lanes of chunks. Responses, errors and system messages go to the urgent
+// lane and are dispatched before others , but after MQ_URGENT_BURST urgent messages in a row
+// one normal message is dispatched , so the normal lane would never starve.
+
+#define MQ_URGENT 0
+#define MQ_NORMAL 1
+#define MQ_LANE 2
+#define MQ_URGENT_BURST 16
+
+struct mq_chunk {
+	struct mq_chunk * volatile next;
+	// link of retired list , don't reuse next : a producer with an old tail may still follow it
+	struct mq_chunk * retired;
+	int id;
+	int alloc;
+	int ready[MQ_CHUNK_SIZE];
+	struct skynet_message msg[MQ_CHUNK_SIZE];
+};
+
+struct mq_lane {
+	struct mq_chunk * volatile tail;
+	// owned by consumer
+	struct mq_chunk * head;
+	int head_index;
+};
+
 struct message_queue {
 	uint32_t handle;
-	int cap;
-	int head;
-	int tail;
 	int lock;
 	int release;
 	int lock_session;
 	int in_global;
-	struct skynet_message *queue;
+	int producers[2];
+	volatile int gen;
+	struct mq_lane lane[MQ_LANE];
+	struct mq_chunk * spare;
+	// owned by consumer , retired in current generation and before the last flip
+	struct mq_chunk * retired;
+	struct mq_chunk * retired_old;
+	int burst;	// urgent messages dispatched in a row
+	uint64_t affinity;	// workers may run it , 0 for any
+	volatile int out;	// messages popped from chunks , see skynet_mq_size
+	// response of lock session , dispatch before others
+	int locked;
+	struct skynet_message locked_message;
+};
+
+// run queue of one worker thread, used by the steal scheduler.
+// Each worker has another one for the queues pinned to it (see skynet_mq_affinity) , never stolen.
+
+struct local_queue {
+	int lock;
+	int cap;
+	int head;
+	int tail;
+	struct message_queue ** queue;
 };
 
 struct global_queue {
@@ -38,69 +94,366 @@ struct global_queue {
 	uint32_t tail;
 	struct message_queue ** queue;
 	bool * flag;
-
+	int steal;
+	int worker;
+	struct local_queue * local;
+	struct local_queue * pin;
+	// 1 : the worker is waiting in skynet_globalmq_wait , -1 : it's woken up for the shared queues
+	volatile int * idle;
+	int waking;	// workers woken up for the shared queues , but not running yet
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;	// for the threads not a worker
+	pthread_cond_t * wake;	// each worker waits on its own , so a pinned queue wakes up its worker only
+	int sleep;
+	int quit;
 };
 
 static struct global_queue *Q = NULL;
 
+// worker id of current thread, -1 for timer/monitor/main thread
+static __thread int W = -1;
+static __thread uint32_t R = 0;
+static __thread int T = 0;
+
 #define LOCK(q) while (__sync_lock_test_and_set(&(q)->lock,1)) {}
 #define UNLOCK(q) __sync_lock_release(&(q)->lock);
 
 #define GP(p) ((p) % MAX_GLOBAL_MQ)
 
+static inline uint32_t
+_random(void) {
+	// xorshift32 , each thread has its own seed
+	uint32_t x = R;
+	if (x == 0) {
+		x = (uint32_t)(uintptr_t)&R | 1;
+	}
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	R = x;
+	return x;
+}
+
+static void
+_local_push(struct local_queue *lq, struct message_queue * queue) {
+	LOCK(lq)
+	lq->queue[lq->tail] = queue;
+	if (++ lq->tail >= lq->cap) {
+		lq->tail = 0;
+	}
+	if (lq->head == lq->tail) {
+		struct message_queue ** new_queue = malloc(sizeof(struct message_queue *) * lq->cap * 2);
+		int i;
+		for (i=0;i<lq->cap;i++) {
+			new_queue[i] = lq->queue[(lq->head + i) % lq->cap];
+		}
+		lq->head = 0;
+		lq->tail = lq->cap;
+		lq->cap *= 2;
+		free(lq->queue);
+		lq->queue = new_queue;
+	}
+	UNLOCK(lq)
+}
+
+static struct message_queue *
+_local_pop(struct local_queue *lq, int steal) {
+	if (lq->head == lq->tail) {
+		return NULL;
+	}
+	struct message_queue * mq = NULL;
+	if (steal) {
+		// don't wait for a busy victim, try another one
+		if (__sync_lock_test_and_set(&lq->lock,1)) {
+			return NULL;
+		}
+	} else {
+		LOCK(lq)
+	}
+	if (lq->head != lq->tail) {
+		mq = lq->queue[lq->head];
+		if (++ lq->head >= lq->cap) {
+			lq->head = 0;
+		}
+	}
+	UNLOCK(lq)
+	return mq;
+}
+
+static void
+_pin_push(struct global_queue *q, struct message_queue * queue) {
+	uint64_t mask = queue->affinity;
+	int w = W;
+	if (w < 0 || w >= 64 || !(mask & ((uint64_t)1 << w))) {
+		// pick one of the allowed workers
+		int n = _random() % __builtin_popcountll(mask);
+		for (w=0;;w++) {
+			if ((mask & ((uint64_t)1 << w)) && n-- == 0) {
+				break;
+			}
+		}
+	}
+	_local_push(&q->pin[w], queue);
+	__sync_synchronize();
+	if (q->idle[w] > 0) {
+		pthread_mutex_lock(&q->mutex);
+		if (q->idle[w] > 0) {
+			q->idle[w] = 0;
+			pthread_cond_signal(&q->wake[w]);
+		}
+		pthread_mutex_unlock(&q->mutex);
+	}
+}
+
+// call it with mutex locked
+static void
+_wakeup(struct global_queue *q) {
+	if (q->waking > 0) {
+		// the worker woken up before will take the queue , or come back for it after its work
+		return;
+	}
+	int n = q->worker;
+	int start = _random() % n;
+	int i;
+	for (i=0;i<n;i++) {
+		int w = (start + i) % n;
+		if (q->idle[w] > 0) {
+			q->idle[w] = -1;
+			++ q->waking;
+			pthread_cond_signal(&q->wake[w]);
+			return;
+		}
+	}
+	// the sleepers are all woken up already , or they are not workers
+	pthread_cond_signal(&q->cond);
+}
+
 static void 
 skynet_globalmq_push(struct message_queue * queue) {
 	struct global_queue *q= Q;
 
-	uint32_t tail = GP(__sync_fetch_and_add(&q->tail,1));
-	q->queue[tail] = queue;
-	__sync_synchronize();
-	q->flag[tail] = true;
+	if (queue->affinity) {
+		_pin_push(q, queue);
+		return;
+	}
+
+	if (q->steal) {
+		// push to the run queue of the pushing worker, other threads pick a random one
+		int w = W;
+		if (w < 0) {
+			w = _random() % q->worker;
+		}
+		_local_push(&q->local[w], queue);
+		__sync_synchronize();
+	} else {
+		uint32_t tail = GP(__sync_fetch_and_add(&q->tail,1));
+		q->queue[tail] = queue;
+		__sync_synchronize();
+		q->flag[tail] = true;
+		__sync_synchronize();
+	}
+
+	if (q->sleep > 0) {
+		// wake up only one sleeping worker for one runnable queue
+		pthread_mutex_lock(&q->mutex);
+		if (q->sleep > 0) {
+			_wakeup(q);
+		}
+		pthread_mutex_unlock(&q->mutex);
+	}
+}
+
+static bool
+_empty(struct global_queue *q) {
+	if (W >= 0 && q->pin[W].head != q->pin[W].tail) {
+		return false;
+	}
+	if (q->steal) {
+		int i;
+		for (i=0;i<q->worker;i++) {
+			struct local_queue * lq = &q->local[i];
+			if (lq->head != lq->tail) {
+				return false;
+			}
+		}
+		return true;
+	}
+	return GP(q->head) == GP(q->tail);
+}
+
+void
+skynet_globalmq_wait(void) {
+	struct global_queue *q = Q;
+	pthread_mutex_lock(&q->mutex);
+	++ q->sleep;
+	if (W >= 0) {
+		q->idle[W] = 1;
+	}
+	// pusher checks sleep after push , so check the queue after sleep is visible
 	__sync_synchronize();
+	if (!q->quit && _empty(q)) {
+		pthread_cond_wait(W >= 0 ? &q->wake[W] : &q->cond, &q->mutex);
+	}
+	if (W >= 0) {
+		if (q->idle[W] < 0) {
+			-- q->waking;
+		}
+		q->idle[W] = 0;
+	}
+	-- q->sleep;
+	pthread_mutex_unlock(&q->mutex);
+}
+
+void
+skynet_globalmq_quit(void) {
+	struct global_queue *q = Q;
+	pthread_mutex_lock(&q->mutex);
+	q->quit = 1;
+	pthread_cond_broadcast(&q->cond);
+	int i;
+	for (i=0;i<q->worker;i++) {
+		pthread_cond_signal(&q->wake[i]);
+	}
+	pthread_mutex_unlock(&q->mutex);
+}
+
+static struct message_queue *
+_steal(struct global_queue *q) {
+	int n = q->worker;
+	int start = _random() % n;
+	int i;
+	for (i=0;i<n;i++) {
+		int victim = (start + i) % n;
+		if (victim == W) {
+			continue;
+		}
+		struct message_queue * mq = _local_pop(&q->local[victim], 1);
+		if (mq) {
+			return mq;
+		}
+	}
+	return NULL;
+}
+
+static struct message_queue *
+_pop(struct global_queue *q) {
+	if (q->steal) {
+		struct message_queue * mq = NULL;
+		if (W >= 0) {
+			mq = _local_pop(&q->local[W], 0);
+		}
+		if (mq == NULL) {
+			mq = _steal(q);
+		}
+		return mq;
+	}
+
+	for (;;) {
+		uint32_t head =  q->head;
+		uint32_t head_ptr = GP(head);
+		if (head_ptr == GP(q->tail)) {
+			return NULL;
+		}
+
+		if(!q->flag[head_ptr]) {
+			// the pusher has got the slot but not finished yet
+			return NULL;
+		}
+
+		struct message_queue * mq = q->queue[head_ptr];
+		if (__sync_bool_compare_and_swap(&q->head, head, head+1)) {
+			q->flag[head_ptr] = false;
+			__sync_synchronize();
+			return mq;
+		}
+		// another worker took this slot , try next one
+	}
 }
 
 struct message_queue * 
 skynet_globalmq_pop() {
 	struct global_queue *q = Q;
-	uint32_t head =  q->head;
-	uint32_t head_ptr = GP(head);
-	if (head_ptr == GP(q->tail)) {
-		return NULL;
+	struct message_queue * mq;
+	// take pinned queues and shared queues by turns , so neither of them starves
+	if (W >= 0 && (++T & 1)) {
+		mq = _local_pop(&q->pin[W], 0);
+		if (mq) {
+			return mq;
+		}
+	}
+	while ((mq = _pop(q))) {
+		if (mq->affinity == 0 || (W >= 0 && W < 64 && (mq->affinity & ((uint64_t)1 << W)))) {
+			return mq;
+		}
+		// the affinity is set after the queue is pushed , hand it to its worker and look for another
+		_pin_push(q, mq);
+	}
+	if (W >= 0) {
+		mq = _local_pop(&q->pin[W], 0);
 	}
+	return mq;
+}
 
-	if(!q->flag[head_ptr]) {
-		return NULL;
+void
+skynet_globalmq_worker(int id) {
+	assert(id >= 0 && id < Q->worker);
+	W = id;
+}
+
+static struct mq_chunk *
+_new_chunk(struct message_queue *q, int id) {
+	struct mq_chunk * c = __sync_lock_test_and_set(&q->spare, NULL);
+	if (c == NULL) {
+		c = malloc(sizeof(*c));
 	}
+	c->next = NULL;
+	c->id = id;
+	c->alloc = 0;
+	memset(c->ready, 0, sizeof(c->ready));
+	return c;
+}
 
-	struct message_queue * mq = q->queue[head_ptr];
-	if (!__sync_bool_compare_and_swap(&q->head, head, head+1)) {
-		return NULL;
+static void
+_free_chunks(struct mq_chunk *c) {
+	while (c) {
+		struct mq_chunk * next = c->next;
+		free(c);
+		c = next;
 	}
-	q->flag[head_ptr] = false;
-	__sync_synchronize();
+}
 
-	return mq;
+static void
+_free_retired(struct mq_chunk *c) {
+	while (c) {
+		struct mq_chunk * next = c->retired;
+		free(c);
+		c = next;
+	}
 }
 
 struct message_queue * 
 skynet_mq_create(uint32_t handle) {
 	struct message_queue *q = malloc(sizeof(*q));
+	memset(q, 0, sizeof(*q));
 	q->handle = handle;
-	q->cap = DEFAULT_QUEUE_SIZE;
-	q->head = 0;
-	q->tail = 0;
-	q->lock = 0;
 	q->in_global = MQ_IN_GLOBAL;
-	q->release = 0;
-	q->lock_session = 0;
-	q->queue = malloc(sizeof(struct skynet_message) * q->cap);
+	int i;
+	for (i=0;i<MQ_LANE;i++) {
+		q->lane[i].head = q->lane[i].tail = _new_chunk(q, 0);
+	}
 
 	return q;
 }
 
 static void 
 _release(struct message_queue *q) {
-	free(q->queue);
+	int i;
+	for (i=0;i<MQ_LANE;i++) {
+		_free_chunks(q->lane[i].head);
+	}
+	_free_retired(q->retired);
+	_free_retired(q->retired_old);
+	free(q->spare);
 	free(q);
 }
 
@@ -109,96 +462,297 @@ skynet_mq_handle(struct message_queue *q) {
 	return q->handle;
 }
 
+// return the generation , pass it to _leave
+static inline int
+_enter(struct message_queue *q) {
+	for (;;) {
+		int g = q->gen;
+		__sync_add_and_fetch(&q->producers[g], 1);
+		// the consumer may flip gen before we are counted , it won't wait for the old generation then
+		if (q->gen == g) {
+			return g;
+		}
+		__sync_sub_and_fetch(&q->producers[g], 1);
+	}
+}
 
-int
-skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
-	int ret = 1;
-	LOCK(q)
+static inline void
+_leave(struct message_queue *q, int g) {
+	__sync_sub_and_fetch(&q->producers[g], 1);
+}
 
-	if (q->head != q->tail) {
-		*message = q->queue[q->head];
-		ret = 0;
-		if ( ++ q->head >= q->cap) {
-			q->head = 0;
+static void
+_recycle(struct message_queue *q, struct mq_chunk *c) {
+	if (q->spare == NULL) {
+		struct mq_chunk * next = c->retired;
+		if (__sync_bool_compare_and_swap(&q->spare, NULL, c)) {
+			c = next;
 		}
 	}
+	_free_retired(c);
+}
 
-	if (ret) {
-		q->in_global = 0;
+// called by consumer
+static void
+_reclaim(struct message_queue *q) {
+	__sync_synchronize();
+	if (q->retired_old) {
+		if (q->producers[q->gen ^ 1]) {
+			// a producer entered before the flip may still hold an old tail chunk
+			return;
+		}
+		_recycle(q, q->retired_old);
+		q->retired_old = NULL;
 	}
-	
-	UNLOCK(q)
+	if (q->retired) {
+		q->retired_old = q->retired;
+		q->retired = NULL;
+		// producers enter the new generation from now , they can't see the chunks retired
+		q->gen ^= 1;
+		__sync_synchronize();
+		if (q->producers[q->gen ^ 1] == 0) {
+			_recycle(q, q->retired_old);
+			q->retired_old = NULL;
+		}
+	}
+}
 
+static void
+_retire(struct message_queue *q, struct mq_chunk *c) {
+	c->retired = q->retired;
+	q->retired = c;
+	_reclaim(q);
+}
+
+static struct skynet_message *
+_peek(struct message_queue *q, struct mq_lane *l) {
+	struct mq_chunk * c = l->head;
+	if (l->head_index == MQ_CHUNK_SIZE) {
+		struct mq_chunk * next = c->next;
+		if (next == NULL) {
+			return NULL;
+		}
+		l->head = next;
+		l->head_index = 0;
+		// tail may not move yet , the chunk retired should never be the tail
+		__sync_bool_compare_and_swap(&l->tail, c, next);
+		_retire(q, c);
+		c = next;
+	}
+	if (!c->ready[l->head_index]) {
+		return NULL;
+	}
+	return &c->msg[l->head_index];
+}
+
+// read only version of _peek , another worker may own the queue now.
+static int
+_pending(struct message_queue *q) {
+	int ret = 0;
+	// count as a producer , so chunks would not be freed
+	int g = _enter(q);
+	int n;
+	for (n=0;n<MQ_LANE && !ret;n++) {
+		struct mq_chunk * c = q->lane[n].head;
+		int i = q->lane[n].head_index;
+		if (i == MQ_CHUNK_SIZE) {
+			c = c->next;
+			i = 0;
+		}
+		ret = c && c->ready[i];
+	}
+	_leave(q, g);
 	return ret;
 }
 
-static void
-expand_queue(struct message_queue *q) {
-	struct skynet_message *new_queue = malloc(sizeof(struct skynet_message) * q->cap * 2);
-	int i;
-	for (i=0;i<q->cap;i++) {
-		new_queue[i] = q->queue[(q->head + i) % q->cap];
+static struct skynet_message *
+_select(struct message_queue *q, struct mq_lane **lane) {
+	struct skynet_message * urgent = _peek(q, &q->lane[MQ_URGENT]);
+	if (urgent && q->burst < MQ_URGENT_BURST) {
+		++ q->burst;
+		*lane = &q->lane[MQ_URGENT];
+		return urgent;
 	}
-	q->head = 0;
-	q->tail = q->cap;
-	q->cap *= 2;
-	
-	free(q->queue);
-	q->queue = new_queue;
+	struct skynet_message * m = _peek(q, &q->lane[MQ_NORMAL]);
+	if (m) {
+		q->burst = 0;
+		*lane = &q->lane[MQ_NORMAL];
+		return m;
+	}
+	// nothing is starving
+	*lane = &q->lane[MQ_URGENT];
+	return urgent;
 }
 
-static void 
-_pushhead(struct message_queue *q, struct skynet_message *message) {
-	int head = q->head - 1;
-	if (head < 0) {
-		head = q->cap - 1;
+int
+skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
+	if (q->locked) {
+		*message = q->locked_message;
+		q->locked = 0;
+		return 0;
 	}
-	if (head == q->tail) {
-		expand_queue(q);
-		--q->tail;
-		head = q->cap - 1;
+
+	struct skynet_message * m;
+	struct mq_lane * l;
+	while ((m = _select(q, &l)) == NULL) {
+		// the mailbox is drained , free the chunks retired before the queue may go to another worker
+		_reclaim(q);
+		q->in_global = 0;
+		__sync_synchronize();
+		// a producer finished after _peek may have seen in_global != 0 , take the queue back
+		if (!_pending(q) || !__sync_bool_compare_and_swap(&q->in_global, 0, MQ_IN_GLOBAL)) {
+			return 1;
+		}
+	}
+
+	*message = *m;
+	++ l->head_index;
+	++ q->out;
+
+	return 0;
+}
+
+// messages pushed into the lane since it's created
+static inline int
+_lane_in(struct mq_lane *l) {
+	struct mq_chunk * tail = l->tail;
+	int alloc = tail->alloc;
+	if (alloc > MQ_CHUNK_SIZE) {
+		alloc = MQ_CHUNK_SIZE;
 	}
+	return tail->id * MQ_CHUNK_SIZE + alloc;
+}
 
-	q->queue[head] = *message;
-	q->head = head;
+int
+skynet_mq_size(struct message_queue *q) {
+	// count as a producer , so the tail chunk would not be freed
+	int g = _enter(q);
+	int in = _lane_in(&q->lane[MQ_URGENT]) + _lane_in(&q->lane[MQ_NORMAL]);
+	_leave(q, g);
+	return in - q->out;
+}
+
+int
+skynet_mq_length(struct message_queue *q) {
+	// call it from the consumer , the producers may push more at the same time
+	int len = q->locked;
+	int i;
+	for (i=0;i<MQ_LANE;i++) {
+		struct mq_lane * l = &q->lane[i];
+		len += _lane_in(l) - l->head->id * MQ_CHUNK_SIZE - l->head_index;
+	}
+	return len;
+}
+
+int
+skynet_mq_locked(struct message_queue *q) {
+	return q->in_global == MQ_DISPATCHING;
+}
+
+// return 1 if the caller should push q into global queue
+static int
+_pushhead(struct message_queue *q, struct skynet_message *message) {
+	assert(q->locked == 0);
+	q->locked_message = *message;
+	q->locked = 1;
+	q->lock_session = 0;
 
 	// this api use in push a unlock message, so the in_global flags must not be 0 , 
 	// but the q is not exist in global queue.
 	if (q->in_global == MQ_LOCKED) {
-		skynet_globalmq_push(q);
 		q->in_global = MQ_IN_GLOBAL;
-	} else {
-		assert(q->in_global == MQ_DISPATCHING);
+		return 1;
 	}
-	q->lock_session = 0;
+	assert(q->in_global == MQ_DISPATCHING);
+	return 0;
 }
 
-void 
-skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
-	assert(message);
-	LOCK(q)
-	
-	if (q->lock_session !=0 && message->session == q->lock_session) {
-		_pushhead(q,message);
-	} else {
-		q->queue[q->tail] = *message;
-		if (++ q->tail >= q->cap) {
-			q->tail = 0;
-		}
+static int STAT = 0;
+
+void
+skynet_mq_stat(int on) {
+	STAT = on;
+}
+
+int
+skynet_mq_stat_on(void) {
+	return STAT;
+}
+
+uint32_t
+skynet_mq_time(void) {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint32_t)ti.tv_sec * 1000000 + ti.tv_nsec / 1000;
+}
+
+static inline int
+_lane(struct skynet_message *message) {
+	int type = message->sz >> HANDLE_REMOTE_SHIFT;
+	if (type == PTYPE_RESPONSE || type == PTYPE_ERROR || type == PTYPE_SYSTEM) {
+		return MQ_URGENT;
+	}
+	return MQ_NORMAL;
+}
 
-		if (q->head == q->tail) {
-			expand_queue(q);
+static void
+_push(struct message_queue *q, struct skynet_message *message) {
+	struct mq_lane * l = &q->lane[_lane(message)];
+	int g = _enter(q);
+	for (;;) {
+		struct mq_chunk * c = l->tail;
+		int idx = __sync_fetch_and_add(&c->alloc, 1);
+		if (idx < MQ_CHUNK_SIZE) {
+			c->msg[idx] = *message;
+			__sync_synchronize();
+			c->ready[idx] = 1;
+			break;
+		}
+		// the chunk is full , link a new one or help the one who did it
+		struct mq_chunk * next = c->next;
+		if (next == NULL) {
+			struct mq_chunk * n = _new_chunk(q, c->id + 1);
+			n->alloc = 1;
+			n->msg[0] = *message;
+			n->ready[0] = 1;
+			if (__sync_bool_compare_and_swap(&c->next, NULL, n)) {
+				__sync_bool_compare_and_swap(&l->tail, c, n);
+				break;
+			}
+			if (!__sync_bool_compare_and_swap(&q->spare, NULL, n)) {
+				free(n);
+			}
+			next = c->next;
 		}
+		__sync_bool_compare_and_swap(&l->tail, c, next);
+	}
+	_leave(q, g);
+}
 
-		if (q->lock_session == 0) {
-			if (q->in_global == 0) {
-				q->in_global = MQ_IN_GLOBAL;
+void 
+skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
+	assert(message);
+	message->time = STAT ? skynet_mq_time() : 0;
+	int session = message->session;
+	if (session != 0 && session == q->lock_session) {
+		LOCK(q)
+		if (session == q->lock_session) {
+			int push = _pushhead(q,message);
+			UNLOCK(q)
+			if (push) {
 				skynet_globalmq_push(q);
 			}
+			return;
 		}
+		UNLOCK(q)
+	}
+
+	_push(q, message);
+
+	// the consumer clears in_global when mq is empty , and checks again after that.
+	if (q->in_global == 0 && __sync_bool_compare_and_swap(&q->in_global, 0, MQ_IN_GLOBAL)) {
+		skynet_globalmq_push(q);
 	}
-	
-	UNLOCK(q)
 }
 
 void
@@ -212,15 +766,54 @@ skynet_mq_lock(struct message_queue *q, int session) {
 }
 
 void 
-skynet_mq_init() {
+skynet_mq_init(int worker, int steal) {
 	struct global_queue *q = malloc(sizeof(*q));
 	memset(q,0,sizeof(*q));
 	q->queue = malloc(MAX_GLOBAL_MQ * sizeof(struct message_queue *));
 	q->flag = malloc(MAX_GLOBAL_MQ * sizeof(bool));
 	memset(q->flag, 0, sizeof(bool) * MAX_GLOBAL_MQ);
+	q->steal = steal;
+	q->worker = worker;
+	q->local = malloc(worker * 2 * sizeof(struct local_queue));
+	q->pin = q->local + worker;
+	q->idle = malloc(worker * sizeof(int));
+	q->wake = malloc(worker * sizeof(pthread_cond_t));
+	int i;
+	for (i=0;i<worker*2;i++) {
+		struct local_queue * lq = &q->local[i];
+		lq->lock = 0;
+		lq->cap = DEFAULT_LOCAL_QUEUE;
+		lq->head = 0;
+		lq->tail = 0;
+		lq->queue = malloc(lq->cap * sizeof(struct message_queue *));
+	}
+	for (i=0;i<worker;i++) {
+		q->idle[i] = 0;
+		pthread_cond_init(&q->wake[i], NULL);
+	}
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->cond, NULL);
 	Q=q;
 }
 
+uint64_t
+skynet_mq_affinity(struct message_queue *q, uint64_t workers) {
+	int n = Q->worker;
+	uint64_t all = n < 64 ? ((uint64_t)1 << n) - 1 : ~(uint64_t)0;
+	workers &= all;
+	if (workers == all) {
+		// any worker , the shared queues are cheaper than the pinned ones (never stolen)
+		workers = 0;
+	}
+	q->affinity = workers;
+	return workers;
+}
+
+uint64_t
+skynet_mq_getaffinity(struct message_queue *q) {
+	return q->affinity;
+}
+
 void 
 skynet_mq_force_push(struct message_queue * queue) {
 	assert(queue->in_global);
@@ -229,6 +822,12 @@ skynet_mq_force_push(struct message_queue * queue) {
 
 void 
 skynet_mq_pushglobal(struct message_queue *queue) {
+	// only the owner sets lock_session , so no lock needed if it's not set
+	if (queue->lock_session == 0 && queue->in_global == MQ_IN_GLOBAL) {
+		skynet_globalmq_push(queue);
+		return;
+	}
+	int push = 0;
 	LOCK(queue)
 	assert(queue->in_global);
 	if (queue->in_global == MQ_DISPATCHING) {
@@ -236,10 +835,14 @@ skynet_mq_pushglobal(struct message_queue *queue) {
 		queue->in_global = MQ_LOCKED;
 	}
 	if (queue->lock_session == 0) {
-		skynet_globalmq_push(queue);
 		queue->in_global = MQ_IN_GLOBAL;
+		push = 1;
 	}
 	UNLOCK(queue)
+	// another worker may take the queue at once , so push it after unlock
+	if (push) {
+		skynet_globalmq_push(queue);
+	}
 }
 
 void 
@@ -260,7 +863,7 @@ _drop_queue(struct message_queue *q) {
 			assert((msg.sz & HANDLE_MASK) == 0);
 			skynet_multicast_dispatch((struct skynet_multicast_message *)msg.data, NULL, NULL);
 		} else {
-			free(msg.data);
+			skynet_free(msg.data);
 		}
 	}
 	_release(q);
@@ -9,11 +9,22 @@ struct skynet_message {
 	int session;
 	void * data;
 	size_t sz;
+	uint32_t time;	// enqueue time in microsecond , set by skynet_mq_push if stat is on , wrap around
+	// the payload is at data + offset , data is the (shared) block to free. see skynet_send_slice
+	uint32_t offset;
 };
 
+uint32_t skynet_mq_time(void);
+// stamp messages and collect dispatch stat , off by default
+void skynet_mq_stat(int on);
+int skynet_mq_stat_on(void);
+
 struct message_queue;
 
 struct message_queue * skynet_globalmq_pop(void);
+void skynet_globalmq_worker(int id);
+void skynet_globalmq_wait(void);
+void skynet_globalmq_quit(void);
 
 struct message_queue * skynet_mq_create(uint32_t handle);
 void skynet_mq_mark_release(struct message_queue *q);
@@ -24,10 +35,19 @@ uint32_t skynet_mq_handle(struct message_queue *);
 int skynet_mq_pop(struct message_queue *q, struct skynet_message *message);
 void skynet_mq_push(struct message_queue *q, struct skynet_message *message);
 void skynet_mq_lock(struct message_queue *q, int session);
+int skynet_mq_length(struct message_queue *q);
+// length seen by producers , may be a little larger than skynet_mq_length
+int skynet_mq_size(struct message_queue *q);
+// 1 when LOCK is called in dispatching
+int skynet_mq_locked(struct message_queue *q);
+
+// bit i for worker i , 0 for any worker. return the mask of existing workers
+uint64_t skynet_mq_affinity(struct message_queue *q, uint64_t workers);
+uint64_t skynet_mq_getaffinity(struct message_queue *q);
 
 void skynet_mq_force_push(struct message_queue *q);
 void skynet_mq_pushglobal(struct message_queue *q);
 
-void skynet_mq_init();
+void skynet_mq_init(int worker, int steal);
 
 #endif
@@ -15,7 +15,7 @@ struct skynet_multicast_message {
 
 struct skynet_multicast_message * 
 skynet_multicast_create(const void * msg, size_t sz, uint32_t source) {
-	struct skynet_multicast_message * mc = malloc(sizeof(*mc));
+	struct skynet_multicast_message * mc = skynet_malloc(sizeof(*mc));
 	mc->ref = 0;
 	mc->msg = msg;
 	mc->sz = sz;
@@ -27,8 +27,8 @@ void
 skynet_multicast_copy(struct skynet_multicast_message *mc, int copy) {
 	int r = __sync_add_and_fetch(&mc->ref, copy);
 	if (r == 0) {
-		free((void *)mc->msg);
-		free(mc);
+		skynet_free((void *)mc->msg);
+		skynet_free(mc);
 	}
 }
 
@@ -39,8 +39,8 @@ skynet_multicast_dispatch(struct skynet_multicast_message * msg, void * ud, skyn
 	}
 	int ref = __sync_sub_and_fetch(&msg->ref, 1);
 	if (ref == 0) {
-		free((void *)msg->msg);
-		free(msg);
+		skynet_free((void *)msg->msg);
+		skynet_free(msg);
 	}
 }
 
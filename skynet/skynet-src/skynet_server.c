@@ -9,6 +9,7 @@
 #include "skynet_multicast.h"
 #include "skynet_group.h"
 #include "skynet_monitor.h"
+#include "skynet_malloc.h"
 
 #include <string.h>
 #include <assert.h>
@@ -32,12 +33,45 @@
 
 #endif
 
+// messages dispatched in one schedule slot , see skynet_context_message_dispatch
+
+struct drain_budget {
+	int count;
+	int time;	// microsecond , 0 for no limit
+	int weight;	// -1 for disable , or drain at least (mailbox length >> weight)
+};
+
+// log2 histograms , bucket i counts values in [2^(i-1) , 2^i) , bucket 0 counts 0.
+// Only the dispatching thread writes them , STAT reads them without lock.
+
+#define STAT_BUCKET 33
+#define STAT_WAIT 0	// microseconds from enqueue to dispatch
+#define STAT_RUN 1	// microseconds in callback
+#define STAT_DEPTH 2	// mailbox length when the context is scheduled
+#define STAT_KIND 3
+
+struct dispatch_stat {
+	uint64_t bucket[STAT_KIND][STAT_BUCKET];
+};
+
+// mailbox limit , responses are never limited , or the sessions waiting for them would hang.
+
+#define MAILBOX_REJECT 0	// drop new message , and send PTYPE_ERROR to the session of sender
+#define MAILBOX_DROP 1	// drop oldest messages when dispatching , the same as above for each
+#define MAILBOX_BLOCK 2	// accept all , skynet_overload tells the sender (gate) to stop reading
+
+struct mailbox {
+	int limit;	// 0 for unlimited
+	int policy;
+	bool overload;	// high watermark is reported , cleared when length < limit/2
+};
+
 struct skynet_context {
 	void * instance;
 	struct skynet_module * mod;
 	uint32_t handle;
 	int ref;
-	char result[32];
+	char result[64];
 	void * cb_ud;
 	skynet_cb cb;
 	int session_id;
@@ -45,11 +79,25 @@ struct skynet_context {
 	struct message_queue *queue;
 	bool init;
 	bool endless;
+	bool slice;	// gets the slices without copy , see skynet_send_slice
+	struct drain_budget drain;
+	struct mailbox mailbox;
+	struct dispatch_stat stat;
+	struct skynet_name_cache name_cache[NAME_CACHE_SIZE];
+	struct skynet_context * next;	// link in free list
 
 	CHECKCALLING_DECL
 };
 
 static int g_total_context = 0;
+static struct drain_budget g_drain = { 1, 0, -1 };
+static struct mailbox g_mailbox = { 0, MAILBOX_REJECT, false };
+
+// skynet_handle_grab reads the context pointer without lock , so the memory of a context
+// is never returned to malloc , deleted contexts are reused by skynet_context_new.
+
+static struct skynet_context * g_free_context = NULL;
+static int g_free_lock = 0;
 
 int 
 skynet_context_total() {
@@ -66,6 +114,30 @@ _context_dec() {
 	__sync_fetch_and_sub(&g_total_context,1);
 }
 
+static struct skynet_context *
+_context_alloc() {
+	while (__sync_lock_test_and_set(&g_free_lock,1)) {}
+	struct skynet_context * ctx = g_free_context;
+	if (ctx) {
+		g_free_context = ctx->next;
+	}
+	__sync_lock_release(&g_free_lock);
+	if (ctx == NULL) {
+		ctx = malloc(sizeof(*ctx));
+	}
+	return ctx;
+}
+
+static void
+_context_free(struct skynet_context *ctx) {
+	// ref is 0 now , clear handle so that a stale grab fails after ctx is reused
+	ctx->handle = 0;
+	while (__sync_lock_test_and_set(&g_free_lock,1)) {}
+	ctx->next = g_free_context;
+	g_free_context = ctx;
+	__sync_lock_release(&g_free_lock);
+}
+
 static void
 _id_to_hex(char * str, uint32_t id) {
 	int i;
@@ -87,7 +159,7 @@ skynet_context_new(const char * name, const char *param) {
 	void *inst = skynet_module_instance_create(mod);
 	if (inst == NULL)
 		return NULL;
-	struct skynet_context * ctx = malloc(sizeof(*ctx));
+	struct skynet_context * ctx = _context_alloc();
 	CHECKCALLING_INIT(ctx)
 
 	ctx->mod = mod;
@@ -100,6 +172,11 @@ skynet_context_new(const char * name, const char *param) {
 	ctx->forward = 0;
 	ctx->init = false;
 	ctx->endless = false;
+	ctx->slice = false;
+	ctx->drain = g_drain;
+	ctx->mailbox = g_mailbox;
+	memset(&ctx->stat, 0, sizeof(ctx->stat));
+	memset(ctx->name_cache, 0, sizeof(ctx->name_cache));
 	ctx->handle = skynet_handle_register(ctx);
 	struct message_queue * queue = ctx->queue = skynet_mq_create(ctx->handle);
 	// init function maybe use ctx->handle, so it must init at last
@@ -131,16 +208,30 @@ skynet_context_newsession(struct skynet_context *ctx) {
 	return session;
 }
 
-void 
-skynet_context_grab(struct skynet_context *ctx) {
-	__sync_add_and_fetch(&ctx->ref,1);
+struct skynet_context *
+skynet_context_grab(struct skynet_context *ctx, uint32_t handle) {
+	// ctx may be deleted or reused by another thread , never raise ref from 0
+	for (;;) {
+		int ref = ctx->ref;
+		if (ref == 0) {
+			return NULL;
+		}
+		if (__sync_bool_compare_and_swap(&ctx->ref, ref, ref+1)) {
+			break;
+		}
+	}
+	if (ctx->handle != handle) {
+		skynet_context_release(ctx);
+		return NULL;
+	}
+	return ctx;
 }
 
 static void 
 _delete_context(struct skynet_context *ctx) {
 	skynet_module_instance_release(ctx->mod, ctx->instance);
 	skynet_mq_mark_release(ctx->queue);
-	free(ctx);
+	_context_free(ctx);
 	_context_dec();
 }
 
@@ -153,16 +244,103 @@ skynet_context_release(struct skynet_context *ctx) {
 	return ctx;
 }
 
+static inline bool
+_limited(int type) {
+	// socket events are never rejected , the stream would break. Owners pause reading instead
+	return type != PTYPE_RESPONSE && type != PTYPE_ERROR && type != PTYPE_SYSTEM && type != PTYPE_SOCKET;
+}
+
+// release the payload of a message not dispatched
+static void
+_drop_message(struct skynet_message *msg) {
+	if ((msg->sz >> HANDLE_REMOTE_SHIFT) == PTYPE_MULTICAST) {
+		// shared by the receivers of the group , release one reference
+		skynet_multicast_dispatch((struct skynet_multicast_message *)msg->data, NULL, NULL);
+	} else {
+		skynet_free(msg->data);
+	}
+}
+
+static const char * 
+_policy_name(int policy) {
+	switch (policy) {
+	case MAILBOX_REJECT:
+		return "reject";
+	case MAILBOX_DROP:
+		return "drop";
+	case MAILBOX_BLOCK:
+		return "block";
+	}
+	return "";
+}
+
+static bool
+_mailbox_full(struct skynet_context *ctx, int length) {
+	struct mailbox * mb = &ctx->mailbox;
+	if (length < mb->limit) {
+		if (mb->overload && length < mb->limit / 2) {
+			mb->overload = false;
+		}
+		return false;
+	}
+	if (!mb->overload) {
+		mb->overload = true;
+		skynet_error(NULL, "Mailbox of %x is full (%d messages) , policy %s", ctx->handle, length, _policy_name(mb->policy));
+	}
+	return true;
+}
+
 int
 skynet_context_push(uint32_t handle, struct skynet_message *message) {
 	struct skynet_context * ctx = skynet_handle_grab(handle);
 	if (ctx == NULL) {
 		return -1;
 	}
-	skynet_mq_push(ctx->queue, message);
+	int ret = 0;
+	if (ctx->mailbox.limit > 0 && ctx->mailbox.policy == MAILBOX_REJECT
+		&& _limited(message->sz >> HANDLE_REMOTE_SHIFT)
+		&& _mailbox_full(ctx, skynet_mq_size(ctx->queue))) {
+		ret = -2;
+	} else {
+		skynet_mq_push(ctx->queue, message);
+	}
 	skynet_context_release(ctx);
 
-	return 0;
+	return ret;
+}
+
+int
+skynet_overload(uint32_t handle) {
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx == NULL) {
+		return 0;
+	}
+	int ret = ctx->mailbox.limit > 0 && _mailbox_full(ctx, skynet_mq_size(ctx->queue));
+	skynet_context_release(ctx);
+	return ret;
+}
+
+// tell the session of sender its request is dropped
+static void
+_send_error(uint32_t from, uint32_t source, int session, int type) {
+	if (session == 0 || !_limited(type)) {
+		return;
+	}
+	if (skynet_harbor_message_isremote(source)) {
+		struct remote_message * rmsg = skynet_malloc(sizeof(*rmsg));
+		rmsg->destination.handle = source;
+		rmsg->message = NULL;
+		rmsg->sz = (size_t)PTYPE_ERROR << HANDLE_REMOTE_SHIFT;
+		skynet_harbor_send(rmsg, from, session);
+	} else {
+		struct skynet_message smsg;
+		smsg.source = from;
+		smsg.session = session;
+		smsg.data = NULL;
+		smsg.offset = 0;
+		smsg.sz = (size_t)PTYPE_ERROR << HANDLE_REMOTE_SHIFT;
+		skynet_context_push(source, &smsg);
+	}
 }
 
 void 
@@ -187,15 +365,28 @@ skynet_isremote(struct skynet_context * ctx, uint32_t handle, int * harbor) {
 static void
 _send_message(uint32_t des, struct skynet_message *msg) {
 	if (skynet_harbor_message_isremote(des)) {
-			struct remote_message * rmsg = malloc(sizeof(*rmsg));
+			void * data = msg->data;
+			if (msg->offset) {
+				// a slice can't be sent to harbor , copy it
+				size_t sz = msg->sz & HANDLE_MASK;
+				data = skynet_malloc(sz);
+				memcpy(data, (char *)msg->data + msg->offset, sz);
+				skynet_free(msg->data);
+			}
+			struct remote_message * rmsg = skynet_malloc(sizeof(*rmsg));
 			rmsg->destination.handle = des;
-			rmsg->message = msg->data;
+			rmsg->message = data;
 			rmsg->sz = msg->sz;
 			skynet_harbor_send(rmsg, msg->source, msg->session);
 	} else {
-		if (skynet_context_push(des, msg)) {
-			free(msg->data);
-			skynet_error(NULL, "Drop message from %x forward to %x (size=%d)", msg->source, des, (int)msg->sz);
+		int r = skynet_context_push(des, msg);
+		if (r) {
+			skynet_free(msg->data);
+			if (r == -2) {
+				_send_error(des, msg->source, msg->session, msg->sz >> HANDLE_REMOTE_SHIFT);
+			} else {
+				skynet_error(NULL, "Drop message from %x forward to %x (size=%d)", msg->source, des, (int)msg->sz);
+			}
 		}
 	}
 }
@@ -223,8 +414,10 @@ _mc(void *ud, uint32_t source, const void * msg, size_t sz) {
 		struct skynet_message message;
 		message.source = source;
 		message.session = 0;
-		message.data = malloc(sz);
-		memcpy(message.data, msg, sz);
+		// share the payload of multicast message , it's released by the last receiver
+		skynet_ref((void *)msg, 1);
+		message.data = (void *)msg;
+		message.offset = 0;
 		message.sz = sz  | (type << HANDLE_REMOTE_SHIFT);
 		_send_message(des, &message);
 	}
@@ -239,15 +432,159 @@ _dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 	if (type == PTYPE_MULTICAST) {
 		skynet_multicast_dispatch((struct skynet_multicast_message *)msg->data, ctx, _mc);
 	} else {
-		int reserve = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, msg->data, sz);
+		if (msg->offset && !ctx->slice) {
+			// the receiver may keep the message (return 1 or skynet_ref) , so it gets a block of its own
+			char * data = skynet_malloc(sz+1);
+			memcpy(data, (char *)msg->data + msg->offset, sz);
+			data[sz] = '\0';
+			skynet_free(msg->data);
+			msg->data = data;
+			msg->offset = 0;
+		}
+		int reserve = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, (char *)msg->data + msg->offset, sz);
+		if (reserve && msg->offset) {
+			// the block is not known by the receiver , leave it rather than free it under the receiver
+			skynet_error(ctx, "Can't keep the slice from %x , see SLICE", msg->source);
+		}
 		reserve |= _forwarding(ctx, msg);
 		if (!reserve) {
-			free(msg->data);
+			skynet_free(msg->data);
 		}
 	}
 	CHECKCALLING_END(ctx)
 }
 
+static int
+_parse_drain(struct drain_budget *d, const char * param) {
+	struct drain_budget tmp = { 1, 0, -1 };
+	int n = sscanf(param, "%d %d %d", &tmp.count, &tmp.time, &tmp.weight);
+	if (n < 1 || tmp.count < 1 || tmp.time < 0) {
+		return 1;
+	}
+	*d = tmp;
+	return 0;
+}
+
+void
+skynet_drain_init(const char * param) {
+	if (param && _parse_drain(&g_drain, param)) {
+		fprintf(stderr, "Invalid drain config %s\n", param);
+	}
+}
+
+static int
+_parse_mailbox(struct mailbox *mb, const char * param) {
+	int limit = 0;
+	char policy[16] = "reject";
+	if (sscanf(param, "%d %15s", &limit, policy) < 1 || limit < 0) {
+		return 1;
+	}
+	int i;
+	for (i=MAILBOX_REJECT;i<=MAILBOX_BLOCK;i++) {
+		if (strcmp(policy, _policy_name(i)) == 0) {
+			mb->limit = limit;
+			mb->policy = i;
+			mb->overload = false;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void
+skynet_mailbox_init(const char * param) {
+	if (param && _parse_mailbox(&g_mailbox, param)) {
+		fprintf(stderr, "Invalid mailbox config %s\n", param);
+	}
+}
+
+// workers list such as "0,2-3" , "*" for any worker
+static int
+_parse_workers(const char * str, uint64_t * mask) {
+	uint64_t m = 0;
+	if (strcmp(str, "*") == 0) {
+		*mask = 0;
+		return 0;
+	}
+	while (*str) {
+		char * end;
+		long from = strtol(str, &end, 10);
+		long to = from;
+		if (end == str) {
+			return 1;
+		}
+		if (*end == '-') {
+			str = end + 1;
+			to = strtol(str, &end, 10);
+			if (end == str) {
+				return 1;
+			}
+		}
+		if (from < 0 || to < from || to >= 64) {
+			return 1;
+		}
+		for (;from<=to;from++) {
+			m |= (uint64_t)1 << from;
+		}
+		str = end;
+		if (*str == ',') {
+			++str;
+		} else if (*str) {
+			return 1;
+		}
+	}
+	*mask = m;
+	return 0;
+}
+
+static const char *
+_affinity_command(struct skynet_context * context, const char * param) {
+	uint64_t mask;
+	if (param && param[0]) {
+		if (_parse_workers(param, &mask)) {
+			skynet_error(context, "Invalid affinity %s", param);
+			return NULL;
+		}
+		mask = skynet_mq_affinity(context->queue, mask);
+	} else {
+		mask = skynet_mq_getaffinity(context->queue);
+	}
+	// result is the workers list , "*" for any worker
+	char * buf = context->result;
+	int sz = sizeof(context->result);
+	int n = 0;
+	int i = 0;
+	if (mask == 0) {
+		strcpy(buf, "*");
+		return buf;
+	}
+	buf[0] = '\0';
+	while (i < 64) {
+		if (!(mask & ((uint64_t)1 << i))) {
+			++i;
+			continue;
+		}
+		int from = i;
+		while (i < 64 && (mask & ((uint64_t)1 << i))) {
+			++i;
+		}
+		int w = from == i-1 ?
+			snprintf(buf+n, sz-n, "%s%d", n ? "," : "", from) :
+			snprintf(buf+n, sz-n, "%s%d-%d", n ? "," : "", from, i-1);
+		if (w >= sz-n) {
+			break;
+		}
+		n += w;
+	}
+	return buf;
+}
+
+static inline void
+_stat(struct dispatch_stat *s, int kind, uint32_t v) {
+	int b = v == 0 ? 0 : 32 - __builtin_clz(v);
+	++s->bucket[kind][b];
+}
+
 int
 skynet_context_message_dispatch(struct skynet_monitor *sm) {
 	struct message_queue * q = skynet_globalmq_pop();
@@ -265,19 +602,78 @@ skynet_context_message_dispatch(struct skynet_monitor *sm) {
 		return 0;
 	}
 
-	struct skynet_message msg;
-	if (skynet_mq_pop(q,&msg)) {
-		skynet_context_release(ctx);
-		return 0;
+	struct drain_budget drain = ctx->drain;
+	int n = drain.count;
+	if (drain.weight >= 0) {
+		int len = skynet_mq_length(q) >> drain.weight;
+		if (len > n) {
+			n = len;
+		}
+	}
+	int drop = 0;
+	if (ctx->mailbox.limit > 0) {
+		int len = skynet_mq_length(q);
+		if (_mailbox_full(ctx, len) && ctx->mailbox.policy == MAILBOX_DROP) {
+			drop = len - ctx->mailbox.limit;
+		}
+	}
+	int stat = skynet_mq_stat_on();
+	uint32_t now = 0;
+	if (stat || drain.time > 0) {
+		now = skynet_mq_time();
+	}
+	uint32_t deadline = now + drain.time;
+	if (stat) {
+		_stat(&ctx->stat, STAT_DEPTH, skynet_mq_length(q));
 	}
 
-	skynet_monitor_trigger(sm, msg.source , handle);
+	int i;
+	for (i=0;i<n;i++) {
+		struct skynet_message msg;
+		if (skynet_mq_pop(q,&msg)) {
+			// mq is empty and not in global mq now
+			skynet_context_release(ctx);
+			skynet_monitor_trigger(sm, 0,0);
+			return 0;
+		}
 
-	if (ctx->cb == NULL) {
-		free(msg.data);
-		skynet_error(NULL, "Drop message from %x to %x without callback , size = %d",msg.source, handle, (int)msg.sz);
-	} else {
-		_dispatch_message(ctx, &msg);
+		skynet_monitor_trigger(sm, msg.source , handle);
+		if (stat && msg.time) {
+			// the message may be pushed after now
+			int32_t wait = (int32_t)(now - msg.time);
+			_stat(&ctx->stat, STAT_WAIT, wait > 0 ? wait : 0);
+		}
+
+		if (drop > 0 && _limited(msg.sz >> HANDLE_REMOTE_SHIFT)) {
+			// drop oldest
+			--drop;
+			_drop_message(&msg);
+			_send_error(handle, msg.source, msg.session, msg.sz >> HANDLE_REMOTE_SHIFT);
+			continue;
+		}
+
+		if (ctx->cb == NULL) {
+			_drop_message(&msg);
+			skynet_error(NULL, "Drop message from %x to %x without callback , size = %d",msg.source, handle, (int)msg.sz);
+		} else {
+			_dispatch_message(ctx, &msg);
+		}
+
+		if (stat || drain.time > 0) {
+			uint32_t end = skynet_mq_time();
+			if (stat) {
+				_stat(&ctx->stat, STAT_RUN, end - now);
+			}
+			now = end;
+		}
+
+		if (skynet_mq_locked(q)) {
+			// LOCK command in dispatch , stop here and wait for the locked session
+			break;
+		}
+		if (drain.time > 0 && (int32_t)(now - deadline) >= 0) {
+			break;
+		}
 	}
 
 	assert(q == ctx->queue);
@@ -335,29 +731,160 @@ _group_command(struct skynet_context * ctx, const char * cmd, int handle, uint32
 	return NULL;
 }
 
+// "on" / "off" switches stat of all services ,
+// "wait" , "run" or "depth" returns "count p50 p90 p99 max" , each is the upper bound of a bucket.
+// "wait 3" returns the count of bucket 3 , "reset" clears all.
+static const char *
+_stat_command(struct skynet_context * context, const char * param) {
+	static const char * kinds[STAT_KIND] = { "wait", "run", "depth" };
+	if (param == NULL) {
+		return NULL;
+	}
+	if (strcmp(param, "reset") == 0) {
+		memset(&context->stat, 0, sizeof(context->stat));
+		return NULL;
+	}
+	if (strcmp(param, "on") == 0 || strcmp(param, "off") == 0) {
+		// global switch
+		skynet_mq_stat(param[1] == 'n');
+		return NULL;
+	}
+	char kind[16];
+	int index = -1;
+	if (sscanf(param, "%15s %d", kind, &index) < 1) {
+		return NULL;
+	}
+	int k;
+	for (k=0;k<STAT_KIND;k++) {
+		if (strcmp(kind, kinds[k]) == 0)
+			break;
+	}
+	if (k == STAT_KIND) {
+		return NULL;
+	}
+	uint64_t * bucket = context->stat.bucket[k];
+	if (index >= 0) {
+		if (index >= STAT_BUCKET) {
+			return NULL;
+		}
+		sprintf(context->result, "%llu", (unsigned long long)bucket[index]);
+		return context->result;
+	}
+	uint64_t total = 0;
+	int i;
+	for (i=0;i<STAT_BUCKET;i++) {
+		total += bucket[i];
+	}
+	static const int percent[3] = { 50, 90, 99 };
+	uint64_t bound[4] = { 0, 0, 0, 0 };
+	uint64_t sum = 0;
+	int p = 0;
+	for (i=0;i<STAT_BUCKET;i++) {
+		if (bucket[i] == 0)
+			continue;
+		sum += bucket[i];
+		uint64_t upper = i == 0 ? 0 : ((uint64_t)1 << i) - 1;
+		while (p < 3 && sum * 100 >= total * percent[p]) {
+			bound[p++] = upper;
+		}
+		bound[3] = upper;
+	}
+	snprintf(context->result, sizeof(context->result), "%llu %llu %llu %llu %llu",
+		(unsigned long long)total, (unsigned long long)bound[0], (unsigned long long)bound[1],
+		(unsigned long long)bound[2], (unsigned long long)bound[3]);
+	return context->result;
+}
+
 uint32_t 
 skynet_queryname(struct skynet_context * context, const char * name) {
 	switch(name[0]) {
 	case ':':
 		return strtoul(name+1,NULL,16);
 	case '.':
+		if (context) {
+			return skynet_handle_findname_cache(name + 1, context->name_cache);
+		}
 		return skynet_handle_findname(name + 1);
 	}
 	skynet_error(context, "Don't support query global name %s",name);
 	return 0;
 }
 
+// typed api for the hot commands , skynet_command keeps the string version of them
+
+int
+skynet_timeout_session(struct skynet_context * context, int time) {
+	int session = skynet_context_newsession(context);
+	if (session < 0)
+		return -1;
+	skynet_timeout(context->handle, time, session);
+	return session;
+}
+
+int
+skynet_timeout_session_ms(struct skynet_context * context, int time) {
+	int session = skynet_context_newsession(context);
+	if (session < 0)
+		return -1;
+	skynet_timeout_ms(context->handle, time, session);
+	return session;
+}
+
+int
+skynet_cancel(struct skynet_context * context, int session) {
+	return skynet_timeout_cancel(context->handle, session);
+}
+
+uint32_t
+skynet_self(struct skynet_context * context) {
+	return context->handle;
+}
+
+uint32_t
+skynet_now(void) {
+	return skynet_gettime();
+}
+
+uint64_t
+skynet_now_ms(void) {
+	return skynet_gettime_ms();
+}
+
+uint32_t
+skynet_starttime(void) {
+	return skynet_gettime_fixsec();
+}
+
+static const char *
+_session_result(struct skynet_context * context, int session) {
+	if (session < 0)
+		return NULL;
+	sprintf(context->result, "%d", session);
+	return context->result;
+}
+
 const char * 
 skynet_command(struct skynet_context * context, const char * cmd , const char * param) {
 	if (strcmp(cmd,"TIMEOUT") == 0) {
-		char * session_ptr = NULL;
-		int ti = strtol(param, &session_ptr, 10);
-		int session = skynet_context_newsession(context);
-		if (session < 0) 
+		int ti = strtol(param, NULL, 10);
+		return _session_result(context, skynet_timeout_session(context, ti));
+	}
+
+	if (strcmp(cmd,"TIMEOUT_MS") == 0) {
+		int ti = strtol(param, NULL, 10);
+		return _session_result(context, skynet_timeout_session_ms(context, ti));
+	}
+
+	if (strcmp(cmd,"CANCEL") == 0) {
+		// param is the session returned by TIMEOUT , return NULL if the timer has expired
+		if (param == NULL) {
 			return NULL;
-		skynet_timeout(context->handle, ti, session);
-		sprintf(context->result, "%d", session);
-		return context->result;
+		}
+		int session = strtol(param, NULL, 10);
+		if (skynet_cancel(context, session)) {
+			return NULL;
+		}
+		return _session_result(context, session);
 	}
 
 	if (strcmp(cmd,"LOCK") == 0) {
@@ -376,7 +903,7 @@ skynet_command(struct skynet_context * context, const char * cmd , const char *
 			return skynet_handle_namehandle(context->handle, param + 1);
 		} else {
 			assert(context->handle!=0);
-			struct remote_name *rname = malloc(sizeof(*rname));
+			struct remote_name *rname = skynet_malloc(sizeof(*rname));
 			_copy_name(rname->name, param);
 			rname->handle = context->handle;
 			skynet_harbor_register(rname);
@@ -399,7 +926,7 @@ skynet_command(struct skynet_context * context, const char * cmd , const char *
 		if (name[0] == '.') {
 			return skynet_handle_namehandle(handle_id, name + 1);
 		} else {
-			struct remote_name *rname = malloc(sizeof(*rname));
+			struct remote_name *rname = skynet_malloc(sizeof(*rname));
 			_copy_name(rname->name, name);
 			rname->handle = handle_id;
 			skynet_harbor_register(rname);
@@ -408,11 +935,28 @@ skynet_command(struct skynet_context * context, const char * cmd , const char *
 	}
 
 	if (strcmp(cmd,"NOW") == 0) {
-		uint32_t ti = skynet_gettime();
+		uint32_t ti = skynet_now();
 		sprintf(context->result,"%u",ti);
 		return context->result;
 	}
 
+	if (strcmp(cmd,"NOW_MS") == 0) {
+		uint64_t ti = skynet_now_ms();
+		sprintf(context->result,"%llu",(unsigned long long)ti);
+		return context->result;
+	}
+
+	if (strcmp(cmd,"SLAB") == 0) {
+		// param is the size class , result is "size alloc inuse carve" , size 0 for large block
+		struct skynet_malloc_stat stat;
+		if (param == NULL || skynet_malloc_stat(strtol(param, NULL, 10), &stat)) {
+			return NULL;
+		}
+		snprintf(context->result, sizeof(context->result), "%u %llu %llu %llu", (unsigned)stat.size,
+			(unsigned long long)stat.alloc, (unsigned long long)stat.inuse, (unsigned long long)stat.carve);
+		return context->result;
+	}
+
 	if (strcmp(cmd,"EXIT") == 0) {
 		skynet_handle_retire(context->handle);
 		return NULL;
@@ -440,12 +984,24 @@ skynet_command(struct skynet_context * context, const char * cmd , const char *
 		strcpy(tmp,param);
 		char * args = tmp;
 		char * mod = strsep(&args, " \t\r\n");
+		uint64_t affinity = 0;
+		if (mod[0] == '@') {
+			// "@0,2-3 mod args" pins the new service to the workers
+			if (args == NULL || _parse_workers(mod+1, &affinity)) {
+				skynet_error(context, "Invalid launch affinity %s", mod);
+				return NULL;
+			}
+			mod = strsep(&args, " \t\r\n");
+		}
 		args = strsep(&args, "\r\n");
 		struct skynet_context * inst = skynet_context_new(mod,args);
 		if (inst == NULL) {
 			fprintf(stderr, "Launch %s %s failed\n",mod,args);
 			return NULL;
 		} else {
+			if (affinity) {
+				skynet_mq_affinity(inst->queue, affinity);
+			}
 			_id_to_hex(context->result, inst->handle);
 			return context->result;
 		}
@@ -473,7 +1029,7 @@ skynet_command(struct skynet_context * context, const char * cmd , const char *
 	}
 
 	if (strcmp(cmd,"STARTTIME") == 0) {
-		uint32_t sec = skynet_gettime_fixsec();
+		uint32_t sec = skynet_starttime();
 		sprintf(context->result,"%u",sec);
 		return context->result;
 	}
@@ -499,6 +1055,43 @@ skynet_command(struct skynet_context * context, const char * cmd , const char *
 		return NULL;
 	}
 
+	if (strcmp(cmd,"SLICE") == 0) {
+		// param is 1 to get the slices without copy (the service never keeps a message) , 0 to get copies
+		if (param && param[0]) {
+			context->slice = strtol(param, NULL, 10) != 0;
+		}
+		strcpy(context->result, context->slice ? "1" : "0");
+		return context->result;
+	}
+
+	if (strcmp(cmd,"DRAIN") == 0) {
+		if (param == NULL || _parse_drain(&context->drain, param)) {
+			skynet_error(context, "Invalid drain budget %s", param ? param : "");
+		}
+		return NULL;
+	}
+
+	if (strcmp(cmd,"MAILBOX") == 0) {
+		// param is "limit [reject|drop|block]" , result is "length limit policy"
+		if (param && param[0]) {
+			if (_parse_mailbox(&context->mailbox, param)) {
+				skynet_error(context, "Invalid mailbox %s", param);
+				return NULL;
+			}
+		}
+		snprintf(context->result, sizeof(context->result), "%d %d %s", skynet_mq_length(context->queue),
+			context->mailbox.limit, _policy_name(context->mailbox.policy));
+		return context->result;
+	}
+
+	if (strcmp(cmd,"STAT") == 0) {
+		return _stat_command(context, param);
+	}
+
+	if (strcmp(cmd,"AFFINITY") == 0) {
+		return _affinity_command(context, param);
+	}
+
 	if (strcmp(cmd,"ABORT") == 0) {
 		skynet_handle_retireall();
 		return NULL;
@@ -528,7 +1121,7 @@ _filter_args(struct skynet_context * context, int type, int *session, void ** da
 	if (dontcopy || *data == NULL) {
 		msg = *data;
 	} else {
-		msg = malloc(*sz+1);
+		msg = skynet_malloc(*sz+1);
 		memcpy(msg, *data, *sz);
 		msg[*sz] = '\0';
 	}
@@ -538,10 +1131,8 @@ _filter_args(struct skynet_context * context, int type, int *session, void ** da
 	*sz |= type << HANDLE_REMOTE_SHIFT;
 }
 
-int
-skynet_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * data, size_t sz) {
-	_filter_args(context, type, &session, (void **)&data, &sz);
-
+static int
+_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * data, uint32_t offset, size_t sz) {
 	if (source == 0) {
 		source = context->handle;
 	}
@@ -550,7 +1141,7 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 		return session;
 	}
 	if (skynet_harbor_message_isremote(destination)) {
-		struct remote_message * rmsg = malloc(sizeof(*rmsg));
+		struct remote_message * rmsg = skynet_malloc(sizeof(*rmsg));
 		rmsg->destination.handle = destination;
 		rmsg->message = data;
 		rmsg->sz = sz;
@@ -560,10 +1151,20 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 		smsg.source = source;
 		smsg.session = session;
 		smsg.data = data;
+		smsg.offset = offset;
 		smsg.sz = sz;
 
-		if (skynet_context_push(destination, &smsg)) {
-			free(data);
+		int r = skynet_context_push(destination, &smsg);
+		if (r) {
+			skynet_free(data);
+			if (r == -2) {
+				// request gets an error response , others get -2
+				if (session != 0 && _limited(sz >> HANDLE_REMOTE_SHIFT)) {
+					_send_error(destination, source, session, sz >> HANDLE_REMOTE_SHIFT);
+					return session;
+				}
+				return -2;
+			}
 			skynet_error(NULL, "Drop message from %x to %x (type=%d)(size=%d)", source, destination, type, (int)(sz & HANDLE_MASK));
 			return -1;
 		}
@@ -571,6 +1172,24 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 	return session;
 }
 
+int
+skynet_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * data, size_t sz) {
+	_filter_args(context, type, &session, (void **)&data, &sz);
+	return _send(context, source, destination, type & 0xff, session, data, 0, sz);
+}
+
+int
+skynet_send_slice(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * block, const void * msg, size_t sz) {
+	if (destination == 0 || skynet_harbor_message_isremote(destination)) {
+		return skynet_send(context, source, destination, type & ~PTYPE_TAG_DONTCOPY, session, (void *)msg, sz);
+	}
+	// the message holds a reference of block , released by skynet_free after dispatch
+	skynet_ref(block, 1);
+	void * data = block;
+	_filter_args(context, type | PTYPE_TAG_DONTCOPY, &session, &data, &sz);
+	return _send(context, source, destination, type & 0xff, session, data, (const char *)msg - (char *)block, sz);
+}
+
 int
 skynet_sendname(struct skynet_context * context, const char * addr , int type, int session, void * data, size_t sz) {
 	uint32_t source = context->handle;
@@ -578,16 +1197,16 @@ skynet_sendname(struct skynet_context * context, const char * addr , int type, i
 	if (addr[0] == ':') {
 		des = strtoul(addr+1, NULL, 16);
 	} else if (addr[0] == '.') {
-		des = skynet_handle_findname(addr + 1);
+		des = skynet_handle_findname_cache(addr + 1, context->name_cache);
 		if (des == 0) {
-			free(data);
+			skynet_free(data);
 			skynet_error(context, "Drop message to %s", addr);
 			return session;
 		}
 	} else {
 		_filter_args(context, type, &session, (void **)&data, &sz);
 
-		struct remote_message * rmsg = malloc(sizeof(*rmsg));
+		struct remote_message * rmsg = skynet_malloc(sizeof(*rmsg));
 		_copy_name(rmsg->destination.name, addr);
 		rmsg->destination.handle = 0;
 		rmsg->message = data;
@@ -622,6 +1241,7 @@ skynet_context_send(struct skynet_context * ctx, void * msg, size_t sz, uint32_t
 	smsg.source = source;
 	smsg.session = session;
 	smsg.data = msg;
+	smsg.offset = 0;
 	smsg.sz = sz | type << HANDLE_REMOTE_SHIFT;
 
 	skynet_mq_push(ctx->queue, &smsg);
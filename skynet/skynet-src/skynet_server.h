@@ -9,7 +9,7 @@ struct skynet_message;
 struct skynet_monitor;
 
 struct skynet_context * skynet_context_new(const char * name, const char * parm);
-void skynet_context_grab(struct skynet_context *);
+struct skynet_context * skynet_context_grab(struct skynet_context *, uint32_t handle);
 struct skynet_context * skynet_context_release(struct skynet_context *);
 uint32_t skynet_context_handle(struct skynet_context *);
 void skynet_context_init(struct skynet_context *, uint32_t handle);
@@ -18,6 +18,8 @@ void skynet_context_send(struct skynet_context * context, void * msg, size_t sz,
 int skynet_context_newsession(struct skynet_context *);
 int skynet_context_message_dispatch(struct skynet_monitor *);	// return 1 when block
 int skynet_context_total();
+void skynet_drain_init(const char * param);
+void skynet_mailbox_init(const char * param);
 
 void skynet_context_endless(uint32_t handle);	// for monitor
 
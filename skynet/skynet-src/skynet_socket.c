@@ -0,0 +1,183 @@
+#include "skynet.h"
+
+#include "skynet_socket.h"
+#include "socket_server.h"
+#include "skynet_server.h"
+#include "skynet_mq.h"
+#include "skynet_harbor.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+static struct socket_server * SOCKET_SERVER = NULL;
+
+// "event [level|edge]" , the max number of events got by one wait and the trigger mode
+static int
+_parse_socket(const char * param, int *event, int *edge) {
+	char mode[16] = "level";
+	if (sscanf(param, "%d %15s", event, mode) < 1 || *event <= 0) {
+		return 1;
+	}
+	if (strcmp(mode, "edge") == 0) {
+		*edge = 1;
+	} else if (strcmp(mode, "level") != 0) {
+		return 1;
+	}
+	return 0;
+}
+
+void
+skynet_socket_init(const char * param) {
+	int event = 0;
+	int edge = 0;
+	if (param && _parse_socket(param, &event, &edge)) {
+		fprintf(stderr, "Invalid socket config %s\n", param);
+		event = 0;
+		edge = 0;
+	}
+	SOCKET_SERVER = socket_server_create(event, edge);
+	if (SOCKET_SERVER == NULL) {
+		fprintf(stderr, "Init socket server failed\n");
+		exit(1);
+	}
+}
+
+void
+skynet_socket_exit(void) {
+	socket_server_exit(SOCKET_SERVER);
+}
+
+void
+skynet_socket_free(void) {
+	socket_server_release(SOCKET_SERVER);
+	SOCKET_SERVER = NULL;
+}
+
+// push the event into the mailbox of the owner directly , no service between them
+static void
+forward_message(int type, int padding, struct socket_message * result) {
+	struct skynet_socket_message *sm;
+	int sz = sizeof(*sm);
+	if (padding) {
+		if (result->data) {
+			sz += strlen(result->data);
+		} else {
+			result->data = "";
+		}
+	}
+	sm = skynet_malloc(sz + 1);
+	sm->type = type;
+	sm->id = result->id;
+	sm->ud = result->ud;
+	if (padding) {
+		sm->buffer = NULL;
+		strcpy((char *)(sm+1), result->data);
+	} else {
+		sm->buffer = result->data;
+	}
+
+	struct skynet_message message;
+	message.source = 0;
+	message.session = 0;
+	message.data = sm;
+	message.offset = 0;
+	message.sz = sz | PTYPE_SOCKET << HANDLE_REMOTE_SHIFT;
+
+	if (skynet_context_push((uint32_t)result->opaque, &message)) {
+		// the owner has gone
+		skynet_free(sm->buffer);
+		skynet_free(sm);
+	}
+}
+
+int
+skynet_socket_poll(void) {
+	struct socket_server *ss = SOCKET_SERVER;
+	assert(ss);
+	struct socket_message result;
+	int more = 1;
+	int type = socket_server_poll(ss, &result, &more);
+	switch (type) {
+	case SOCKET_EXIT:
+		return 0;
+	case SOCKET_DATA:
+		forward_message(SKYNET_SOCKET_TYPE_DATA, 0, &result);
+		break;
+	case SOCKET_CLOSE:
+		forward_message(SKYNET_SOCKET_TYPE_CLOSE, 1, &result);
+		break;
+	case SOCKET_OPEN:
+		forward_message(SKYNET_SOCKET_TYPE_CONNECT, 1, &result);
+		break;
+	case SOCKET_ERROR:
+		forward_message(SKYNET_SOCKET_TYPE_ERROR, 1, &result);
+		break;
+	case SOCKET_ACCEPT:
+		forward_message(SKYNET_SOCKET_TYPE_ACCEPT, 1, &result);
+		break;
+	default:
+		break;
+	}
+	if (more) {
+		return -1;
+	}
+	return 1;
+}
+
+int
+skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz) {
+	return socket_server_send(SOCKET_SERVER, id, buffer, sz);
+}
+
+int
+skynet_socket_send_slice(struct skynet_context *ctx, int id, void *buffer, int offset, int sz) {
+	return socket_server_send_slice(SOCKET_SERVER, id, buffer, offset, sz);
+}
+
+int
+skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog, int reuseport) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_listen(SOCKET_SERVER, source, host, port, backlog, reuseport);
+}
+
+int
+skynet_socket_connect(struct skynet_context *ctx, const char *host, int port) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_connect(SOCKET_SERVER, source, host, port);
+}
+
+int
+skynet_socket_bind(struct skynet_context *ctx, int fd) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_bind(SOCKET_SERVER, source, fd);
+}
+
+void
+skynet_socket_close(struct skynet_context *ctx, int id) {
+	uint32_t source = skynet_context_handle(ctx);
+	socket_server_close(SOCKET_SERVER, source, id);
+}
+
+void
+skynet_socket_start(struct skynet_context *ctx, int id) {
+	uint32_t source = skynet_context_handle(ctx);
+	socket_server_start(SOCKET_SERVER, source, id);
+}
+
+void
+skynet_socket_pause(struct skynet_context *ctx, int id) {
+	uint32_t source = skynet_context_handle(ctx);
+	socket_server_pause(SOCKET_SERVER, source, id);
+}
+
+void
+skynet_socket_cork(struct skynet_context *ctx, int id, int on) {
+	socket_server_cork(SOCKET_SERVER, id, on);
+}
+
+void
+skynet_socket_limit(struct skynet_context *ctx, int id, int limit) {
+	socket_server_limit(SOCKET_SERVER, id, limit);
+}
@@ -0,0 +1,43 @@
+#ifndef SKYNET_SOCKET_H
+#define SKYNET_SOCKET_H
+
+struct skynet_context;
+
+#define SKYNET_SOCKET_TYPE_DATA 1
+#define SKYNET_SOCKET_TYPE_CONNECT 2
+#define SKYNET_SOCKET_TYPE_CLOSE 3
+#define SKYNET_SOCKET_TYPE_ACCEPT 4
+#define SKYNET_SOCKET_TYPE_ERROR 5
+
+// payload of PTYPE_SOCKET message
+struct skynet_socket_message {
+	int type;
+	int id;
+	int ud;	// size of buffer for DATA , id of new socket for ACCEPT
+	// DATA : allocated by skynet_malloc , the receiver frees it (or passes it on)
+	// others : NULL , and a string (address of peer) follows this struct
+	char * buffer;
+};
+
+// param is "event [level|edge]" , NULL for default (64 level)
+void skynet_socket_init(const char * param);
+void skynet_socket_exit(void);
+void skynet_socket_free(void);
+// run in the socket thread , return 0 when exit , 1 when the events of last wait are handled , -1 for more
+int skynet_socket_poll(void);
+
+// buffer is allocated by skynet_malloc , it belongs to the socket thread after the call
+int skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz);
+// send sz bytes at buffer+offset without copy , buffer (the block) belongs to the socket thread after the call
+int skynet_socket_send_slice(struct skynet_context *ctx, int id, void *buffer, int offset, int sz);
+int skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog, int reuseport);
+int skynet_socket_connect(struct skynet_context *ctx, const char *host, int port);
+int skynet_socket_bind(struct skynet_context *ctx, int fd);
+void skynet_socket_close(struct skynet_context *ctx, int id);
+void skynet_socket_start(struct skynet_context *ctx, int id);
+void skynet_socket_pause(struct skynet_context *ctx, int id);
+// see socket_server_cork and socket_server_limit
+void skynet_socket_cork(struct skynet_context *ctx, int id, int on);
+void skynet_socket_limit(struct skynet_context *ctx, int id, int limit);
+
+#endif
@@ -1,3 +1,9 @@
+#if defined(__linux__)
+// for pthread_setaffinity_np
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
 #include "skynet.h"
 #include "skynet_server.h"
 #include "skynet_imp.h"
@@ -8,18 +14,25 @@
 #include "skynet_harbor.h"
 #include "skynet_group.h"
 #include "skynet_monitor.h"
+#include "skynet_socket.h"
 
 #include <pthread.h>
 #include <unistd.h>
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 struct monitor {
 	int count;
 	struct skynet_monitor ** m;
 };
 
+struct worker_parm {
+	struct monitor * m;
+	int id;
+};
+
 #define CHECK_ABORT if (skynet_context_total()==0) break;
 
 static void *
@@ -48,26 +61,157 @@ _timer(void *p) {
 	for (;;) {
 		skynet_updatetime();
 		CHECK_ABORT
-		usleep(2500);
+		skynet_timer_wait();
+	}
+	// wakeup socket thread and sleeping workers , they will exit
+	skynet_socket_exit();
+	skynet_globalmq_quit();
+	return NULL;
+}
+
+static void *
+_socket(void *p) {
+	for (;;) {
+		int r = skynet_socket_poll();
+		if (r==0)
+			break;
+		if (r<0) {
+			CHECK_ABORT
+			continue;
+		}
 	}
 	return NULL;
 }
 
 static void *
 _worker(void *p) {
-	struct skynet_monitor *sm = p;
+	struct worker_parm *wp = p;
+	struct skynet_monitor *sm = wp->m->m[wp->id];
+	skynet_globalmq_worker(wp->id);
 	for (;;) {
 		if (skynet_context_message_dispatch(sm)) {
 			CHECK_ABORT
-			usleep(1000);
+			skynet_globalmq_wait();
 		} 
 	}
 	return NULL;
 }
 
+#if defined(__linux__)
+
+// read cpu list such as "0-3,8-11" into set , return the number of cpus
+static int
+_cpu_list(cpu_set_t *set, const char * list) {
+	int n = 0;
+	while (*list) {
+		char * end;
+		long from = strtol(list, &end, 10);
+		long to = from;
+		if (end == list) {
+			break;
+		}
+		if (*end == '-') {
+			list = end + 1;
+			to = strtol(list, &end, 10);
+		}
+		for (;from<=to && from < CPU_SETSIZE;from++) {
+			CPU_SET(from, set);
+			++n;
+		}
+		list = end;
+		if (*list != ',') {
+			break;
+		}
+		++list;
+	}
+	return n;
+}
+
+static int
+_node_cpus(cpu_set_t *set, const char * node) {
+	char path[64];
+	char buf[1024];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", node);
+	FILE * f = fopen(path, "r");
+	if (f == NULL) {
+		return 0;
+	}
+	int n = 0;
+	if (fgets(buf, sizeof(buf), f)) {
+		n = _cpu_list(set, buf);
+	}
+	fclose(f);
+	return n;
+}
+
+// affinity is a list of cpus or numa nodes , such as "0-3,6" or "node0,node1".
+// Each cpu or node is one slot , worker i is bound to slot (i % slots) , so a worker bound
+// to a node may still move among the cpus of the node.
+static int
+_cpu_slots(const char * affinity, cpu_set_t * slot, int max) {
+	size_t sz = strlen(affinity);
+	char tmp[sz+1];
+	strcpy(tmp, affinity);
+	char * list = tmp;
+	char * item;
+	int n = 0;
+	while ((item = strsep(&list, ", ")) != NULL && n < max) {
+		if (item[0] == '\0') {
+			continue;
+		}
+		if (strncmp(item, "node", 4) == 0) {
+			CPU_ZERO(&slot[n]);
+			if (_node_cpus(&slot[n], item) == 0) {
+				fprintf(stderr, "Invalid numa node %s\n", item);
+				return 0;
+			}
+			++n;
+			continue;
+		}
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (_cpu_list(&set, item) == 0) {
+			fprintf(stderr, "Invalid cpu %s\n", item);
+			return 0;
+		}
+		int i;
+		for (i=0;i<CPU_SETSIZE && n < max;i++) {
+			if (CPU_ISSET(i, &set)) {
+				CPU_ZERO(&slot[n]);
+				CPU_SET(i, &slot[n]);
+				++n;
+			}
+		}
+	}
+	return n;
+}
+
+static void
+_bind(pthread_t pid[], int thread, const char * affinity) {
+	cpu_set_t slot[thread];
+	int n = _cpu_slots(affinity, slot, thread);
+	int i;
+	for (i=0;i<thread && n>0;i++) {
+		int err = pthread_setaffinity_np(pid[i], sizeof(cpu_set_t), &slot[i % n]);
+		if (err) {
+			fprintf(stderr, "Bind worker %d failed : %s\n", i, strerror(err));
+		}
+	}
+}
+
+#else
+
 static void
-_start(int thread) {
-	pthread_t pid[thread+2];
+_bind(pthread_t pid[], int thread, const char * affinity) {
+	fprintf(stderr, "Affinity %s is not supported on this platform\n", affinity);
+}
+
+#endif
+
+static void
+_start(int thread, const char * affinity) {
+	pthread_t pid[thread+3];
+	struct worker_parm wp[thread];
 
 	struct monitor *m = malloc(sizeof(*m));
 	m->count = thread;
@@ -79,12 +223,18 @@ _start(int thread) {
 
 	pthread_create(&pid[0], NULL, _monitor, m);
 	pthread_create(&pid[1], NULL, _timer, NULL);
+	pthread_create(&pid[2], NULL, _socket, NULL);
 
 	for (i=0;i<thread;i++) {
-		pthread_create(&pid[i+2], NULL, _worker, m->m[i]);
+		wp[i].m = m;
+		wp[i].id = i;
+		pthread_create(&pid[i+3], NULL, _worker, &wp[i]);
+	}
+	if (affinity) {
+		_bind(pid+3, thread, affinity);
 	}
 
-	for (i=1;i<thread+2;i++) {
+	for (i=1;i<thread+3;i++) {
 		pthread_join(pid[i], NULL); 
 	}
 }
@@ -102,9 +252,13 @@ skynet_start(struct skynet_config * config) {
 	skynet_group_init();
 	skynet_harbor_init(config->harbor);
 	skynet_handle_init(config->harbor);
-	skynet_mq_init();
+	skynet_mq_init(config->thread, strcmp(config->scheduler, "steal") == 0);
+	skynet_mq_stat(config->stat);
 	skynet_module_init(config->module_path);
-	skynet_timer_init();
+	skynet_timer_init(config->tick);
+	skynet_drain_init(config->drain);
+	skynet_mailbox_init(config->mailbox);
+	skynet_socket_init(config->socket);
 
 	if (config->standalone) {
 		if (_start_master(config->standalone)) {
@@ -133,6 +287,7 @@ skynet_start(struct skynet_config * config) {
 		ctx = skynet_context_new("snlua", config->start);
 	}
 
-	_start(config->thread);
+	_start(config->thread, config->affinity);
+	skynet_socket_free();
 }
 
@@ -9,10 +9,16 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <unistd.h>
+
 #if defined(__APPLE__)
 #include <sys/time.h>
 #endif
 
+#if defined(__linux__)
+#include <sys/timerfd.h>
+#endif
+
 typedef void (*timer_execute_func)(void *ud,void *arg);
 
 #define TIME_NEAR_SHIFT 8
@@ -22,14 +28,21 @@ typedef void (*timer_execute_func)(void *ud,void *arg);
 #define TIME_NEAR_MASK (TIME_NEAR-1)
 #define TIME_LEVEL_MASK (TIME_LEVEL-1)
 
-struct timer_event {
-	uint32_t handle;
-	int session;
-};
+// Only the timer thread touches the wheel , so it needs no lock. Other threads put new timers
+// into their own buffer , the timer thread merges all buffers once per update , and returns
+// free nodes to the buffers.
+
+#define TIMER_CHUNK 64
+#define TIMER_STRIPE 64
+#define DEFAULT_HASH_SIZE 16
 
 struct timer_node {
 	struct timer_node *next;
-	int expire;
+	struct timer_node *hash_next;
+	uint32_t expire;
+	uint32_t handle;
+	int session;
+	int cancel;
 };
 
 struct link_list {
@@ -37,16 +50,44 @@ struct link_list {
 	struct timer_node *tail;
 };
 
+struct timer_buffer {
+	struct timer_buffer * next;
+	int lock;
+	int used;	// nodes taken since last merge
+	struct timer_node * request;
+	struct timer_node * free;
+};
+
+// pending timers by (handle , session) , a timer is cancelled if it's removed before expired
+
+struct timer_stripe {
+	int lock;
+	int size;
+	int count;
+	struct timer_node ** slot;
+};
+
 struct timer {
 	struct link_list near[TIME_NEAR];
-	struct link_list t[4][TIME_LEVEL-1];
-	int lock;
-	int time;
-	uint32_t current;
+	struct link_list t[4][TIME_LEVEL];
+	// tick counter , wraps around (after 4.9 days at 100us tick) , compare with (int32_t)(a - b)
+	volatile uint32_t time;
+	int tick;	// microseconds per tick
+	int fd;	// timerfd , -1 for polling
+	uint64_t current_tick;
+	uint32_t current;	// centisecond
+	uint64_t current_ms;
 	uint32_t starttime;
+	struct timer_buffer * volatile buffer;
+	struct timer_node * free;
+	struct timer_stripe stripe[TIMER_STRIPE];
 };
 
 static struct timer * TI = NULL;
+static __thread struct timer_buffer * B = NULL;
+
+#define LOCK(q) while (__sync_lock_test_and_set(&(q)->lock,1)) {}
+#define UNLOCK(q) __sync_lock_release(&(q)->lock);
 
 static inline struct timer_node *
 link_clear(struct link_list *list)
@@ -59,7 +100,7 @@ link_clear(struct link_list *list)
 }
 
 static inline void
-link(struct link_list *list,struct timer_node *node)
+link_node(struct link_list *list,struct timer_node *node)
 {
 	list->tail->next = node;
 	list->tail = node;
@@ -69,89 +110,250 @@ link(struct link_list *list,struct timer_node *node)
 static void
 add_node(struct timer *T,struct timer_node *node)
 {
-	int time=node->expire;
-	int current_time=T->time;
+	uint32_t time=node->expire;
+	uint32_t current_time=T->time;
 	
 	if ((time|TIME_NEAR_MASK)==(current_time|TIME_NEAR_MASK)) {
-		link(&T->near[time&TIME_NEAR_MASK],node);
+		link_node(&T->near[time&TIME_NEAR_MASK],node);
 	}
 	else {
 		int i;
-		int mask=TIME_NEAR << TIME_LEVEL_SHIFT;
+		uint32_t mask=TIME_NEAR << TIME_LEVEL_SHIFT;
 		for (i=0;i<3;i++) {
 			if ((time|(mask-1))==(current_time|(mask-1))) {
 				break;
 			}
 			mask <<= TIME_LEVEL_SHIFT;
 		}
-		link(&T->t[i][((time>>(TIME_NEAR_SHIFT + i*TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK)-1],node);	
+		// slot 0 of the last level holds the timers expire after time wraps around
+		link_node(&T->t[i][((time>>(TIME_NEAR_SHIFT + i*TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK)],node);
 	}
 }
 
+static inline uint32_t
+timer_hash(uint32_t handle, int session) {
+	return handle ^ ((uint32_t)session * 2654435761u);
+}
+
+static inline struct timer_stripe *
+hash_stripe(struct timer *T, uint32_t h) {
+	return &T->stripe[h & (TIMER_STRIPE-1)];
+}
+
+static inline struct timer_node **
+hash_slot(struct timer_stripe *s, uint32_t h) {
+	return &s->slot[(h / TIMER_STRIPE) & (s->size-1)];
+}
+
+// stripe must be locked
 static void
-timer_add(struct timer *T,void *arg,size_t sz,int time)
-{
-	struct timer_node *node = (struct timer_node *)malloc(sizeof(*node)+sz);
-	memcpy(node+1,arg,sz);
+hash_insert(struct timer_stripe *s, struct timer_node *node, uint32_t h) {
+	if (s->count >= s->size) {
+		struct timer_node ** old = s->slot;
+		int old_size = s->size;
+		s->size *= 2;
+		s->slot = malloc(s->size * sizeof(struct timer_node *));
+		memset(s->slot, 0, s->size * sizeof(struct timer_node *));
+		int i;
+		for (i=0;i<old_size;i++) {
+			struct timer_node * n = old[i];
+			while (n) {
+				struct timer_node * next = n->hash_next;
+				struct timer_node ** slot = hash_slot(s, timer_hash(n->handle, n->session));
+				n->hash_next = *slot;
+				*slot = n;
+				n = next;
+			}
+		}
+		free(old);
+	}
+	struct timer_node ** slot = hash_slot(s, h);
+	node->hash_next = *slot;
+	*slot = node;
+	++s->count;
+}
 
-	while (__sync_lock_test_and_set(&T->lock,1)) {};
+// stripe must be locked
+static struct timer_node *
+hash_remove(struct timer_stripe *s, uint32_t handle, int session, uint32_t h) {
+	struct timer_node ** slot = hash_slot(s, h);
+	while (*slot) {
+		struct timer_node * n = *slot;
+		if (n->handle == handle && n->session == session) {
+			*slot = n->hash_next;
+			--s->count;
+			return n;
+		}
+		slot = &n->hash_next;
+	}
+	return NULL;
+}
+
+static struct timer_buffer *
+timer_buffer(struct timer *T) {
+	struct timer_buffer * b = B;
+	if (b) {
+		return b;
+	}
+	b = malloc(sizeof(*b));
+	memset(b, 0, sizeof(*b));
+	do {
+		b->next = T->buffer;
+	} while (!__sync_bool_compare_and_swap(&T->buffer, b->next, b));
+	B = b;
+	return b;
+}
+
+static void
+timer_add(struct timer *T, uint32_t handle, int session, int time)
+{
+	struct timer_buffer * b = timer_buffer(T);
+	LOCK(b)
+	struct timer_node * node = b->free;
+	if (node == NULL) {
+		// nodes are never freed , they go back to the buffers after use
+		node = malloc(sizeof(*node) * TIMER_CHUNK);
+		int i;
+		for (i=1;i<TIMER_CHUNK-1;i++) {
+			node[i].next = &node[i+1];
+		}
+		node[TIMER_CHUNK-1].next = NULL;
+		b->free = &node[1];
+	} else {
+		b->free = node->next;
+	}
+	++b->used;
+	node->expire = (uint32_t)time + T->time;
+	node->handle = handle;
+	node->session = session;
+	node->cancel = 0;
+	node->next = b->request;
+
+	uint32_t h = timer_hash(handle, session);
+	struct timer_stripe * s = hash_stripe(T, h);
+	LOCK(s)
+	hash_insert(s, node, h);
+	UNLOCK(s)
+
+	b->request = node;
+	UNLOCK(b)
+}
 
-		node->expire=time+T->time;
-		add_node(T,node);
+static void
+timer_merge(struct timer *T)
+{
+	struct timer_buffer * b = T->buffer;
+	while (b) {
+		if (b->request) {
+			LOCK(b)
+			struct timer_node * req = b->request;
+			b->request = NULL;
+			int n = b->used;
+			b->used = 0;
+			// give back as many nodes as the buffer used
+			while (n > 0 && T->free) {
+				struct timer_node * node = T->free;
+				T->free = node->next;
+				node->next = b->free;
+				b->free = node;
+				--n;
+			}
+			UNLOCK(b)
+			while (req) {
+				struct timer_node * next = req->next;
+				// the timer thread may have moved on since the request was made
+				if ((int32_t)(req->expire - T->time) < 0) {
+					req->expire = T->time;
+				}
+				add_node(T, req);
+				req = next;
+			}
+		}
+		b = b->next;
+	}
+}
 
-	__sync_lock_release(&T->lock);
+static void
+move_list(struct timer *T, int level, int idx) {
+	struct timer_node *current=link_clear(&T->t[level][idx]);
+	while (current) {
+		struct timer_node *temp=current->next;
+		add_node(T,current);
+		current=temp;
+	}
 }
 
-static void 
-timer_execute(struct timer *T)
+// append expired timers to *tail , return new tail
+static struct timer_node **
+timer_execute(struct timer *T, struct timer_node **tail)
 {
-	while (__sync_lock_test_and_set(&T->lock,1)) {};
 	int idx=T->time & TIME_NEAR_MASK;
 	struct timer_node *current;
-	int mask,i,time;
+	uint32_t mask,time;
+	int i;
 	
-	while (T->near[idx].head.next) {
-		current=link_clear(&T->near[idx]);
-		
-		do {
-			struct timer_event * event = (struct timer_event *)(current+1);
-			struct skynet_message message;
-			message.source = 0;
-			message.session = event->session;
-			message.data = NULL;
-			message.sz = PTYPE_RESPONSE << HANDLE_REMOTE_SHIFT;
-
-			skynet_context_push(event->handle, &message);
-			
-			struct timer_node * temp = current;
-			current=current->next;
-			free(temp);	
-		} while (current);
+	current=link_clear(&T->near[idx]);
+	while (current) {
+		struct timer_node * next = current->next;
+		uint32_t h = timer_hash(current->handle, current->session);
+		struct timer_stripe * s = hash_stripe(T, h);
+		LOCK(s)
+		int cancel = current->cancel;
+		if (!cancel) {
+			hash_remove(s, current->handle, current->session, h);
+		}
+		UNLOCK(s)
+		if (cancel) {
+			current->next = T->free;
+			T->free = current;
+		} else {
+			*tail = current;
+			tail = &current->next;
+		}
+		current = next;
 	}
+	*tail = NULL;
 	
-	++T->time;
-	
-	mask = TIME_NEAR;
-	time = T->time >> TIME_NEAR_SHIFT;
-	i=0;
-	
-	while ((T->time & (mask-1))==0) {
-		idx=time & TIME_LEVEL_MASK;
-		if (idx!=0) {
-			--idx;
-			current=link_clear(&T->t[i][idx]);
-			while (current) {
-				struct timer_node *temp=current->next;
-				add_node(T,current);
-				current=temp;
+	uint32_t ct = ++T->time;
+	if (ct == 0) {
+		// time wraps around , the timers of the next round are in t[3][0]
+		move_list(T, 3, 0);
+	} else {
+		mask = TIME_NEAR;
+		time = ct >> TIME_NEAR_SHIFT;
+		i = 0;
+		while ((ct & (mask-1))==0) {
+			idx=time & TIME_LEVEL_MASK;
+			if (idx!=0) {
+				move_list(T, i, idx);
+				break;
 			}
-			break;				
+			mask <<= TIME_LEVEL_SHIFT;
+			time >>= TIME_LEVEL_SHIFT;
+			++i;
 		}
-		mask <<= TIME_LEVEL_SHIFT;
-		time >>= TIME_LEVEL_SHIFT;
-		++i;
-	}	
-	__sync_lock_release(&T->lock);
+	}
+	return tail;
+}
+
+static void
+timer_dispatch(struct timer *T, struct timer_node *current)
+{
+	while (current) {
+		struct skynet_message message;
+		message.source = 0;
+		message.session = current->session;
+		message.data = NULL;
+		message.offset = 0;
+		message.sz = PTYPE_RESPONSE << HANDLE_REMOTE_SHIFT;
+
+		skynet_context_push(current->handle, &message);
+
+		struct timer_node * next = current->next;
+		current->next = T->free;
+		T->free = current;
+		current = next;
+	}
 }
 
 static struct timer *
@@ -167,69 +369,127 @@ timer_create_timer()
 	}
 
 	for (i=0;i<4;i++) {
-		for (j=0;j<TIME_LEVEL-1;j++) {
+		for (j=0;j<TIME_LEVEL;j++) {
 			link_clear(&r->t[i][j]);
 		}
 	}
 
-	r->lock = 0;
 	r->current = 0;
+	r->buffer = NULL;
+	r->free = NULL;
+	for (i=0;i<TIMER_STRIPE;i++) {
+		struct timer_stripe * s = &r->stripe[i];
+		s->size = DEFAULT_HASH_SIZE;
+		s->slot = malloc(s->size * sizeof(struct timer_node *));
+		memset(s->slot, 0, s->size * sizeof(struct timer_node *));
+	}
 
 	return r;
 }
 
-int
-skynet_timeout(uint32_t handle, int time, int session) {
-	if (time == 0) {
+static int
+timer_timeout(uint32_t handle, int64_t tick, int session) {
+	if (tick == 0) {
 		struct skynet_message message;
 		message.source = 0;
 		message.session = session;
 		message.data = NULL;
+		message.offset = 0;
 		message.sz = PTYPE_RESPONSE << HANDLE_REMOTE_SHIFT;
 
 		if (skynet_context_push(handle, &message)) {
 			return -1;
 		}
 	} else {
-		struct timer_event event;
-		event.handle = handle;
-		event.session = session;
-		timer_add(TI, &event, sizeof(event), time);
+		// expire is compared as (int32_t)(expire - time) , so a timer can't be further than 2^31 ticks
+		if (tick > INT32_MAX) {
+			tick = INT32_MAX;
+		}
+		timer_add(TI, handle, session, (int)tick);
 	}
 
 	return session;
 }
 
-static uint32_t
-_gettime(void) {
-	uint32_t t;
+int
+skynet_timeout(uint32_t handle, int time, int session) {
+	int64_t tick = ((int64_t)time * 10000 + TI->tick - 1) / TI->tick;
+	return timer_timeout(handle, tick, session);
+}
+
+int
+skynet_timeout_ms(uint32_t handle, int time, int session) {
+	int64_t tick = ((int64_t)time * 1000 + TI->tick - 1) / TI->tick;
+	return timer_timeout(handle, tick, session);
+}
+
+int
+skynet_timeout_cancel(uint32_t handle, int session) {
+	uint32_t h = timer_hash(handle, session);
+	struct timer_stripe * s = hash_stripe(TI, h);
+	LOCK(s)
+	struct timer_node * node = hash_remove(s, handle, session, h);
+	if (node) {
+		// the timer thread drops the node when it expires
+		node->cancel = 1;
+	}
+	UNLOCK(s)
+	return node ? 0 : -1;
+}
+
+static uint64_t
+_gettime_us(void) {
 #if !defined(__APPLE__)
 	struct timespec ti;
 	clock_gettime(CLOCK_MONOTONIC, &ti);
-	t = (uint32_t)(ti.tv_sec & 0xffffff) * 100;
-	t += ti.tv_nsec / 10000000;
+	return (uint64_t)ti.tv_sec * 1000000 + ti.tv_nsec / 1000;
 #else
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
-	t = (uint32_t)(tv.tv_sec & 0xffffff) * 100;
-	t += tv.tv_usec / 10000;
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 #endif
-	return t;
+}
+
+// centisecond , keep 24 bits of second as before
+static uint32_t
+_centisecond(uint64_t us) {
+	return (uint32_t)((us / 1000000) & 0xffffff) * 100 + (uint32_t)(us % 1000000) / 10000;
 }
 
 void
 skynet_updatetime(void) {
-	uint32_t ct = _gettime();
-	if (ct > TI->current) {
-		int diff = ct-TI->current;
-		TI->current = ct;
+	uint64_t us = _gettime_us();
+	uint64_t ct = us / TI->tick;
+	TI->current = _centisecond(us);
+	TI->current_ms = us / 1000;
+	if (ct > TI->current_tick) {
+		int diff = (int)(ct - TI->current_tick);
+		TI->current_tick = ct;
+		timer_merge(TI);
+		// catch up all missed ticks in one pass , then send messages
+		struct timer_node * expired = NULL;
+		struct timer_node ** tail = &expired;
 		int i;
 		for (i=0;i<diff;i++) {
-			timer_execute(TI);
+			tail = timer_execute(TI, tail);
 		}
+		timer_dispatch(TI, expired);
 	}
 }
 
+void
+skynet_timer_wait(void) {
+#if defined(__linux__)
+	if (TI->fd >= 0) {
+		uint64_t expired;
+		if (read(TI->fd, &expired, sizeof(expired)) == sizeof(expired)) {
+			return;
+		}
+	}
+#endif
+	usleep(TI->tick < 10000 ? TI->tick : 2500);
+}
+
 uint32_t
 skynet_gettime_fixsec(void) {
 	return TI->starttime;
@@ -240,10 +500,41 @@ skynet_gettime(void) {
 	return TI->current;
 }
 
+uint64_t
+skynet_gettime_ms(void) {
+	return TI->current_ms;
+}
+
 void 
-skynet_timer_init(void) {
+skynet_timer_init(int tick) {
 	TI = timer_create_timer();
-	TI->current = _gettime();
+	if (tick <= 0 || tick > 10000) {
+		tick = 10000;
+	} else if (tick < 100) {
+		tick = 100;
+	}
+	TI->tick = tick;
+	uint64_t us = _gettime_us();
+	TI->current = _centisecond(us);
+	TI->current_ms = us / 1000;
+	TI->current_tick = us / tick;
+	TI->fd = -1;
+#if defined(__linux__)
+	if (tick < 10000) {
+		// wake up once per tick instead of polling
+		TI->fd = timerfd_create(CLOCK_MONOTONIC, 0);
+		if (TI->fd >= 0) {
+			struct itimerspec its;
+			its.it_interval.tv_sec = 0;
+			its.it_interval.tv_nsec = tick * 1000;
+			its.it_value = its.it_interval;
+			if (timerfd_settime(TI->fd, 0, &its, NULL)) {
+				close(TI->fd);
+				TI->fd = -1;
+			}
+		}
+	}
+#endif
 
 #if !defined(__APPLE__)
 	struct timespec ti;
@@ -254,7 +545,7 @@ skynet_timer_init(void) {
 	gettimeofday(&tv, NULL);
 	uint32_t sec = (uint32_t)tv.tv_sec;
 #endif
-	uint32_t mono = _gettime() / 100;
+	uint32_t mono = TI->current / 100;
 
 	TI->starttime = sec - mono;
 }
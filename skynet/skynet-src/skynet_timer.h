@@ -3,11 +3,20 @@
 
 #include <stdint.h>
 
+// time is centisecond , return session , which is also the key to cancel the timer
 int skynet_timeout(uint32_t handle, int time, int session);
+// time is millisecond , rounded up to the timer tick
+int skynet_timeout_ms(uint32_t handle, int time, int session);
+// return 0 if cancelled , -1 if the timer has expired or doesn't exist
+int skynet_timeout_cancel(uint32_t handle, int session);
 void skynet_updatetime(void);
+// sleep until next tick
+void skynet_timer_wait(void);
 uint32_t skynet_gettime(void);
+uint64_t skynet_gettime_ms(void);
 uint32_t skynet_gettime_fixsec(void);
 
-void skynet_timer_init(void);
+// tick is microsecond , 10000 (default) or less
+void skynet_timer_init(int tick);
 
 #endif
@@ -0,0 +1,174 @@
+#ifndef SKYNET_SOCKET_POLL_H
+#define SKYNET_SOCKET_POLL_H
+
+/* Test for polling API */
+#ifdef __linux__
+#define HAVE_EPOLL 1
+#endif
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
+#define HAVE_KQUEUE 1
+#endif
+
+#if !defined(HAVE_EPOLL) && !defined(HAVE_KQUEUE)
+#error "system does not support epoll or kqueue API"
+#endif
+/* ! Test for polling API */
+
+#include <sys/types.h>
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#elif HAVE_KQUEUE
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+
+typedef int poll_fd;
+
+struct event {
+	void * s;
+	int read;
+	int write;
+};
+
+static int
+sp_invalid(poll_fd efd) {
+	return efd == -1;
+}
+
+#ifdef HAVE_EPOLL
+
+static poll_fd
+sp_create() {
+	return epoll_create(1024);
+}
+
+static void
+sp_release(poll_fd efd) {
+	close(efd);
+}
+
+// edge triggered when edge is 1 , the caller reads (or accepts) until EAGAIN
+static int
+sp_add(poll_fd efd, int sock, void *ud, int edge) {
+	struct epoll_event ev;
+	ev.events = EPOLLIN | (edge ? EPOLLET : 0);
+	ev.data.ptr = ud;
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, sock, &ev) == -1) {
+		return 1;
+	}
+	return 0;
+}
+
+static void
+sp_del(poll_fd efd, int sock) {
+	struct epoll_event ev;
+	epoll_ctl(efd, EPOLL_CTL_DEL, sock , &ev);
+}
+
+// turn read and write event on or off
+static void
+sp_set(poll_fd efd, int sock, void *ud, int read, int write, int edge) {
+	struct epoll_event ev;
+	ev.events = (read ? EPOLLIN : 0) | (write ? EPOLLOUT : 0) | (edge ? EPOLLET : 0);
+	ev.data.ptr = ud;
+	epoll_ctl(efd, EPOLL_CTL_MOD, sock, &ev);
+}
+
+// timeout is in milliseconds , -1 for infinite
+static int
+sp_wait(poll_fd efd, struct event *e, int max, int timeout) {
+	struct epoll_event ev[max];
+	int n = epoll_wait(efd , ev, max, timeout);
+	int i;
+	for (i=0;i<n;i++) {
+		e[i].s = ev[i].data.ptr;
+		unsigned flag = ev[i].events;
+		e[i].write = (flag & EPOLLOUT) != 0;
+		// hang up and error are reported as readable , read() gets the reason
+		e[i].read = (flag & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+	}
+	return n;
+}
+
+#elif HAVE_KQUEUE
+
+static poll_fd
+sp_create() {
+	return kqueue();
+}
+
+static void
+sp_release(poll_fd efd) {
+	close(efd);
+}
+
+static int
+sp_add(poll_fd efd, int sock, void *ud, int edge) {
+	struct kevent ke;
+	int clear = edge ? EV_CLEAR : 0;
+	EV_SET(&ke, sock, EVFILT_READ, EV_ADD | clear, 0, 0, ud);
+	if (kevent(efd, &ke, 1, NULL, 0, NULL) == -1) {
+		return 1;
+	}
+	EV_SET(&ke, sock, EVFILT_WRITE, EV_ADD | EV_DISABLE | clear, 0, 0, ud);
+	if (kevent(efd, &ke, 1, NULL, 0, NULL) == -1) {
+		EV_SET(&ke, sock, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+		kevent(efd, &ke, 1, NULL, 0, NULL);
+		return 1;
+	}
+	return 0;
+}
+
+static void
+sp_del(poll_fd efd, int sock) {
+	struct kevent ke;
+	EV_SET(&ke, sock, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	kevent(efd, &ke, 1, NULL, 0, NULL);
+	EV_SET(&ke, sock, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+	kevent(efd, &ke, 1, NULL, 0, NULL);
+}
+
+static void
+sp_set(poll_fd efd, int sock, void *ud, int read, int write, int edge) {
+	struct kevent ke;
+	int clear = edge ? EV_CLEAR : 0;
+	EV_SET(&ke, sock, EVFILT_READ, (read ? EV_ENABLE : EV_DISABLE) | clear, 0, 0, ud);
+	kevent(efd, &ke, 1, NULL, 0, NULL);
+	EV_SET(&ke, sock, EVFILT_WRITE, (write ? EV_ENABLE : EV_DISABLE) | clear, 0, 0, ud);
+	kevent(efd, &ke, 1, NULL, 0, NULL);
+}
+
+static int
+sp_wait(poll_fd efd, struct event *e, int max, int timeout) {
+	struct kevent ev[max];
+	struct timespec ts = { timeout / 1000, (timeout % 1000) * 1000000 };
+	int n = kevent(efd, NULL, 0, ev, max, timeout < 0 ? NULL : &ts);
+	int i;
+	for (i=0;i<n;i++) {
+		e[i].s = ev[i].udata;
+		unsigned filter = ev[i].filter;
+		e[i].write = (filter == EVFILT_WRITE);
+		e[i].read = (filter == EVFILT_READ);
+	}
+	return n;
+}
+
+#endif
+
+static void
+sp_nonblocking(int fd) {
+	int flag = fcntl(fd, F_GETFL, 0);
+	if ( -1 == flag ) {
+		return;
+	}
+
+	fcntl(fd, F_SETFL, flag | O_NONBLOCK);
+}
+
+#endif
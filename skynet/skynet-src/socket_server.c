@@ -0,0 +1,1219 @@
+#ifdef __linux__
+#define _GNU_SOURCE	// accept4
+#endif
+
+#include "skynet.h"
+#include "socket_server.h"
+#include "socket_poll.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <stdio.h>
+
+// The socket server runs in its own thread , it owns the event pool and all the sockets.
+// Other threads send requests by the command pipe , a request is written by one write() no larger
+// than PIPE_BUF , so it's atomic and the writers need no lock.
+
+#define MAX_INFO 128
+#define DEFAULT_EVENT 64
+#define MAX_EVENT 4096
+#define MIN_READ_BUFFER 64
+#define MAX_IOV 64
+#define MAX_POOL 4096
+// milliseconds to retry the listeners stopped by accept error
+#define ACCEPT_RETRY 100
+#define MAX_SOCKET_P 16
+#define MAX_SOCKET (1<<MAX_SOCKET_P)
+#define HASH_ID(id) (((unsigned)(id)) % MAX_SOCKET)
+
+#define SOCKET_TYPE_INVALID 0
+#define SOCKET_TYPE_RESERVE 1
+#define SOCKET_TYPE_PLISTEN 2
+#define SOCKET_TYPE_LISTEN 3
+#define SOCKET_TYPE_CONNECTING 4
+#define SOCKET_TYPE_CONNECTED 5
+#define SOCKET_TYPE_HALFCLOSE 6
+#define SOCKET_TYPE_PACCEPT 7
+#define SOCKET_TYPE_BIND 8
+#define SOCKET_TYPE_BINDCLOSE 9
+
+#define SOCKET_OPT_CORK 0
+#define SOCKET_OPT_LIMIT 1
+
+struct write_buffer {
+	struct write_buffer * next;
+	char * ptr;
+	int sz;
+	void * buffer;
+};
+
+struct socket {
+	int fd;
+	int id;
+	int type;
+	int reading;	// 0 when it's paused , or a listener stopped by accept error
+	int edge;	// edge triggered , read until EAGAIN
+	int size;	// size of next read , grows and shrinks by the last read
+	int cork;	// don't write at once , see flush_corked
+	int dirty;	// in the corked list
+	int limit;	// max bytes in write buffer , 0 for no limit
+	int wb_size;	// bytes in write buffer
+	uintptr_t opaque;
+	struct write_buffer * head;
+	struct write_buffer * tail;
+	struct socket * next_dirty;
+	struct socket * next_stopped;
+};
+
+struct socket_server {
+	int recvctrl_fd;
+	int sendctrl_fd;
+	int checkctrl;
+	poll_fd event_fd;
+	int alloc_id;
+	int edge;
+	int event_max;
+	int event_n;
+	int event_index;
+	struct event * ev;
+	// write_buffer nodes for reuse , only the socket thread touches them
+	struct write_buffer * pool;
+	int pool_n;
+	// corked sockets written by requests since the pipe is drained last time
+	struct socket * dirty;
+	// listeners stopped by accept error (out of fd) , see report_accept
+	struct socket * stopped;
+	int accept_error;	// errno of last accept error , reported once
+	struct socket slot[MAX_SOCKET];
+	char info[MAX_INFO];
+};
+
+struct request_open {
+	int id;
+	int port;
+	uintptr_t opaque;
+	char host[1];
+};
+
+struct request_send {
+	int id;
+	int sz;
+	int offset;	// the data is sz bytes at buffer+offset
+	char * buffer;
+};
+
+struct request_close {
+	int id;
+	uintptr_t opaque;
+};
+
+struct request_listen {
+	int id;
+	int fd;
+	uintptr_t opaque;
+};
+
+struct request_bind {
+	int id;
+	int fd;
+	uintptr_t opaque;
+};
+
+struct request_start {
+	int id;
+	uintptr_t opaque;
+};
+
+struct request_setopt {
+	int id;
+	int what;
+	int value;
+};
+
+struct request_package {
+	uint8_t header[8];	// 6 bytes dummy , header[6] is type , header[7] is len
+	union {
+		char buffer[256];
+		struct request_open open;
+		struct request_send send;
+		struct request_close close;
+		struct request_listen listen;
+		struct request_bind bind;
+		struct request_start start;
+		struct request_setopt setopt;
+	} u;
+	uint8_t dummy[256];
+};
+
+static int
+reserve_id(struct socket_server *ss) {
+	int i;
+	for (i=0;i<MAX_SOCKET;i++) {
+		int id = __sync_add_and_fetch(&(ss->alloc_id), 1);
+		if (id < 0) {
+			id = __sync_and_and_fetch(&(ss->alloc_id), 0x7fffffff);
+		}
+		struct socket *s = &ss->slot[HASH_ID(id)];
+		if (s->type == SOCKET_TYPE_INVALID) {
+			if (__sync_bool_compare_and_swap(&s->type, SOCKET_TYPE_INVALID, SOCKET_TYPE_RESERVE)) {
+				s->id = id;
+				s->fd = -1;
+				return id;
+			}
+		}
+	}
+	return -1;
+}
+
+struct socket_server *
+socket_server_create(int event, int edge) {
+	int fd[2];
+	poll_fd efd = sp_create();
+	if (sp_invalid(efd)) {
+		fprintf(stderr, "socket-server: create event pool failed.\n");
+		return NULL;
+	}
+	if (pipe(fd)) {
+		sp_release(efd);
+		fprintf(stderr, "socket-server: create socket pair failed.\n");
+		return NULL;
+	}
+	if (sp_add(efd, fd[0], NULL, 0)) {
+		fprintf(stderr, "socket-server: can't add server fd to event pool.\n");
+		close(fd[0]);
+		close(fd[1]);
+		sp_release(efd);
+		return NULL;
+	}
+	// the pipe is read until EAGAIN , see ctrl_cmd
+	sp_nonblocking(fd[0]);
+
+	struct socket_server *ss = malloc(sizeof(*ss));
+	ss->event_fd = efd;
+	ss->recvctrl_fd = fd[0];
+	ss->sendctrl_fd = fd[1];
+	ss->checkctrl = 1;
+
+	int i;
+	for (i=0;i<MAX_SOCKET;i++) {
+		struct socket *s = &ss->slot[i];
+		s->type = SOCKET_TYPE_INVALID;
+		s->dirty = 0;
+		s->head = NULL;
+		s->tail = NULL;
+	}
+	ss->alloc_id = 0;
+	if (event <= 0) {
+		event = DEFAULT_EVENT;
+	} else if (event > MAX_EVENT) {
+		event = MAX_EVENT;
+	}
+	ss->edge = edge;
+	ss->event_max = event;
+	ss->event_n = 0;
+	ss->event_index = 0;
+	ss->ev = malloc(event * sizeof(struct event));
+	ss->pool = NULL;
+	ss->pool_n = 0;
+	ss->dirty = NULL;
+	ss->stopped = NULL;
+	ss->accept_error = 0;
+
+	return ss;
+}
+
+static struct write_buffer *
+wb_new(struct socket_server *ss) {
+	struct write_buffer * wb = ss->pool;
+	if (wb) {
+		ss->pool = wb->next;
+		--ss->pool_n;
+		return wb;
+	}
+	return skynet_malloc(sizeof(*wb));
+}
+
+static void
+wb_delete(struct socket_server *ss, struct write_buffer *wb) {
+	skynet_free(wb->buffer);
+	if (ss->pool_n >= MAX_POOL) {
+		skynet_free(wb);
+		return;
+	}
+	wb->next = ss->pool;
+	ss->pool = wb;
+	++ss->pool_n;
+}
+
+static void
+free_wb_list(struct socket_server *ss, struct socket *s) {
+	struct write_buffer *wb = s->head;
+	while (wb) {
+		struct write_buffer *tmp = wb;
+		wb = wb->next;
+		wb_delete(ss, tmp);
+	}
+	s->head = s->tail = NULL;
+	s->wb_size = 0;
+}
+
+// a fd may be released , the stopped listeners can accept the connections waiting in backlog
+static void
+resume_listen(struct socket_server *ss) {
+	struct socket * s = ss->stopped;
+	ss->stopped = NULL;
+	while (s) {
+		struct socket * next = s->next_stopped;
+		s->reading = 1;
+		// rearm it , the pending connections trigger a new event even if it's edge triggered
+		sp_set(ss->event_fd, s->fd, s, 1, 0, s->edge);
+		s = next;
+	}
+}
+
+static void
+force_close(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	result->id = s->id;
+	result->ud = 0;
+	result->data = NULL;
+	result->opaque = s->opaque;
+	if (s->type == SOCKET_TYPE_INVALID) {
+		return;
+	}
+	assert(s->type != SOCKET_TYPE_RESERVE);
+	free_wb_list(ss, s);
+	if (s->type != SOCKET_TYPE_PACCEPT && s->type != SOCKET_TYPE_PLISTEN && s->type != SOCKET_TYPE_BINDCLOSE) {
+		sp_del(ss->event_fd, s->fd);
+	}
+	if (s->type == SOCKET_TYPE_LISTEN && !s->reading) {
+		struct socket ** p = &ss->stopped;
+		while (*p != s) {
+			p = &(*p)->next_stopped;
+		}
+		*p = s->next_stopped;
+	}
+	close(s->fd);
+	s->type = SOCKET_TYPE_INVALID;
+	resume_listen(ss);
+}
+
+void
+socket_server_release(struct socket_server *ss) {
+	int i;
+	struct socket_message dummy;
+	for (i=0;i<MAX_SOCKET;i++) {
+		struct socket *s = &ss->slot[i];
+		if (s->type != SOCKET_TYPE_RESERVE) {
+			force_close(ss, s, &dummy);
+		}
+	}
+	close(ss->sendctrl_fd);
+	close(ss->recvctrl_fd);
+	sp_release(ss->event_fd);
+	free(ss->ev);
+	while (ss->pool) {
+		struct write_buffer * wb = ss->pool;
+		ss->pool = wb->next;
+		skynet_free(wb);
+	}
+	free(ss);
+}
+
+static struct socket *
+new_fd(struct socket_server *ss, int id, int fd, uintptr_t opaque, int add) {
+	struct socket * s = &ss->slot[HASH_ID(id)];
+	assert(s->type == SOCKET_TYPE_RESERVE);
+
+	s->edge = ss->edge;
+	if (add) {
+		if (sp_add(ss->event_fd, fd, s, s->edge)) {
+			s->type = SOCKET_TYPE_INVALID;
+			return NULL;
+		}
+	}
+
+	s->id = id;
+	s->fd = fd;
+	s->reading = add;
+	s->size = MIN_READ_BUFFER;
+	s->cork = 0;
+	s->limit = 0;
+	s->wb_size = 0;
+	s->opaque = opaque;
+	assert(s->head == NULL);
+	assert(s->tail == NULL);
+	return s;
+}
+
+// return -1 when connecting
+static int
+open_socket(struct socket_server *ss, struct request_open * request, struct socket_message *result) {
+	int id = request->id;
+	result->opaque = request->opaque;
+	result->id = id;
+	result->ud = 0;
+	result->data = NULL;
+	struct socket *ns;
+	int status;
+	struct addrinfo ai_hints;
+	struct addrinfo *ai_list = NULL;
+	struct addrinfo *ai_ptr = NULL;
+	char port[16];
+	sprintf(port, "%d", request->port);
+	memset( &ai_hints, 0, sizeof( ai_hints ) );
+	ai_hints.ai_family = AF_UNSPEC;
+	ai_hints.ai_socktype = SOCK_STREAM;
+	ai_hints.ai_protocol = IPPROTO_TCP;
+
+	status = getaddrinfo( request->host, port, &ai_hints, &ai_list );
+	if ( status != 0 ) {
+		goto _failed;
+	}
+	int sock= -1;
+	for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next ) {
+		sock = socket( ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol );
+		if ( sock < 0 ) {
+			continue;
+		}
+		int keepalive = 1;
+		setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (void *)&keepalive , sizeof(keepalive));
+		int nodelay = 1;
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (void *)&nodelay , sizeof(nodelay));
+		sp_nonblocking(sock);
+		status = connect( sock, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+		if ( status != 0 && errno != EINPROGRESS) {
+			close(sock);
+			sock = -1;
+			continue;
+		}
+		break;
+	}
+
+	if (sock < 0) {
+		goto _failed;
+	}
+
+	ns = new_fd(ss, id, sock, request->opaque, 1);
+	if (ns == NULL) {
+		close(sock);
+		goto _failed;
+	}
+
+	if(status == 0) {
+		ns->type = SOCKET_TYPE_CONNECTED;
+		struct sockaddr * addr = ai_ptr->ai_addr;
+		void * sin_addr = (ai_ptr->ai_family == AF_INET) ? (void*)&((struct sockaddr_in *)addr)->sin_addr : (void*)&((struct sockaddr_in6 *)addr)->sin6_addr;
+		if (inet_ntop(ai_ptr->ai_family, sin_addr, ss->info, sizeof(ss->info))) {
+			result->data = ss->info;
+		}
+		freeaddrinfo( ai_list );
+		return SOCKET_OPEN;
+	} else {
+		ns->type = SOCKET_TYPE_CONNECTING;
+		sp_set(ss->event_fd, ns->fd, ns, 1, 1, ns->edge);
+	}
+
+	freeaddrinfo( ai_list );
+	return -1;
+_failed:
+	if (ai_list) {
+		freeaddrinfo( ai_list );
+	}
+	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	return SOCKET_ERROR;
+}
+
+// write the buffers by writev , return 0 when all is written , 1 for pending , -1 for error
+static int
+write_list(struct socket_server *ss, struct socket *s) {
+	while (s->head) {
+		struct iovec iov[MAX_IOV];
+		struct write_buffer * wb = s->head;
+		int n = 0;
+		while (wb && n < MAX_IOV) {
+			iov[n].iov_base = wb->ptr;
+			iov[n].iov_len = wb->sz;
+			wb = wb->next;
+			++n;
+		}
+		ssize_t sz;
+		for (;;) {
+			sz = writev(s->fd, iov, n);
+			if (sz >= 0) {
+				break;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN ? 1 : -1;
+		}
+		s->wb_size -= sz;
+		while (sz > 0) {
+			wb = s->head;
+			if (sz < wb->sz) {
+				wb->ptr += sz;
+				wb->sz -= sz;
+				return 1;
+			}
+			sz -= wb->sz;
+			s->head = wb->next;
+			wb_delete(ss, wb);
+		}
+	}
+	s->tail = NULL;
+	return 0;
+}
+
+static int
+send_buffer(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	int r = write_list(ss, s);
+	if (r > 0) {
+		return -1;
+	}
+	if (r < 0) {
+		force_close(ss,s, result);
+		return SOCKET_CLOSE;
+	}
+	sp_set(ss->event_fd, s->fd, s, s->reading, 0, s->edge);
+
+	if (s->type == SOCKET_TYPE_HALFCLOSE) {
+		force_close(ss, s, result);
+		return SOCKET_CLOSE;
+	}
+
+	return -1;
+}
+
+static void
+append_sendbuffer(struct socket_server *ss, struct socket *s, struct request_send * request, int n) {
+	struct write_buffer * buf = wb_new(ss);
+	buf->ptr = request->buffer+request->offset+n;
+	buf->sz = request->sz - n;
+	buf->buffer = request->buffer;
+	buf->next = NULL;
+	s->wb_size += buf->sz;
+	if (s->head == NULL) {
+		s->head = s->tail = buf;
+	} else {
+		assert(s->tail != NULL);
+		assert(s->tail->next == NULL);
+		s->tail->next = buf;
+		s->tail = buf;
+	}
+}
+
+// write directly when the queue is empty , the rest waits for the write event
+static int
+send_socket(struct socket_server *ss, struct request_send * request, struct socket_message *result) {
+	int id = request->id;
+	struct socket * s = &ss->slot[HASH_ID(id)];
+	if (s->type == SOCKET_TYPE_INVALID || s->id != id
+		|| s->type == SOCKET_TYPE_HALFCLOSE
+		|| s->type == SOCKET_TYPE_PACCEPT
+		|| s->type == SOCKET_TYPE_PLISTEN
+		|| s->type == SOCKET_TYPE_LISTEN) {
+		skynet_free(request->buffer);
+		return -1;
+	}
+	if (s->head == NULL && s->type != SOCKET_TYPE_CONNECTING && !s->cork) {
+		int n;
+		for (;;) {
+			n = write(s->fd, request->buffer+request->offset, request->sz);
+			if (n >= 0) {
+				break;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN) {
+				n = 0;
+				break;
+			}
+			// the socket is broken , the read event reports it
+			skynet_free(request->buffer);
+			return -1;
+		}
+		if (n == request->sz) {
+			skynet_free(request->buffer);
+			return -1;
+		}
+		append_sendbuffer(ss, s, request, n);
+		sp_set(ss->event_fd, s->fd, s, s->reading, 1, s->edge);
+	} else {
+		int empty = (s->head == NULL);
+		append_sendbuffer(ss, s, request, 0);
+		if (empty && s->cork && s->type != SOCKET_TYPE_CONNECTING && !s->dirty) {
+			s->dirty = 1;
+			s->next_dirty = ss->dirty;
+			ss->dirty = s;
+		}
+	}
+	// the corked data of this tick isn't written yet , don't count it
+	if (s->limit > 0 && s->wb_size > s->limit && !s->dirty) {
+		// the peer doesn't read , kick it instead of buffering without bound
+		force_close(ss, s, result);
+		result->data = "send buffer overflow";
+		return SOCKET_ERROR;
+	}
+	return -1;
+}
+
+// the corked sockets are written after all the requests in the pipe are handled , so the packages
+// sent in one tick are written by one writev
+static void
+flush_corked(struct socket_server *ss) {
+	struct socket * s = ss->dirty;
+	ss->dirty = NULL;
+	while (s) {
+		struct socket * next = s->next_dirty;
+		s->dirty = 0;
+		// the socket may be closed (and the slot is reused) after it's corked
+		if (s->head && (s->type == SOCKET_TYPE_CONNECTED || s->type == SOCKET_TYPE_HALFCLOSE)) {
+			// a half closed socket is waiting for the write event already , it's closed there
+			if (write_list(ss, s) != 0 && s->type == SOCKET_TYPE_CONNECTED) {
+				// wait for the write event , the error is reported there
+				sp_set(ss->event_fd, s->fd, s, s->reading, 1, s->edge);
+			}
+		}
+		s = next;
+	}
+}
+
+static int
+listen_socket(struct socket_server *ss, struct request_listen * request, struct socket_message *result) {
+	int id = request->id;
+	int listen_fd = request->fd;
+	struct socket *s = new_fd(ss, id, listen_fd, request->opaque, 0);
+	if (s == NULL) {
+		close(listen_fd);
+		result->opaque = request->opaque;
+		result->id = id;
+		result->ud = 0;
+		result->data = NULL;
+		return SOCKET_ERROR;
+	}
+	s->type = SOCKET_TYPE_PLISTEN;
+	return -1;
+}
+
+static int
+close_socket(struct socket_server *ss, struct request_close *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket * s = &ss->slot[HASH_ID(id)];
+	if (s->type == SOCKET_TYPE_INVALID || s->id != id) {
+		return -1;
+	}
+	if (s->head == NULL || s->type != SOCKET_TYPE_CONNECTED) {
+		force_close(ss,s,result);
+		result->opaque = request->opaque;
+		return SOCKET_CLOSE;
+	}
+	// stop reading , and close after the pending data is written
+	s->type = SOCKET_TYPE_HALFCLOSE;
+	s->reading = 0;
+	sp_set(ss->event_fd, s->fd, s, 0, 1, s->edge);
+
+	return -1;
+}
+
+static int
+bind_socket(struct socket_server *ss, struct request_bind *request, struct socket_message *result) {
+	int id = request->id;
+	result->id = id;
+	result->opaque = request->opaque;
+	result->ud = 0;
+	struct socket *s = new_fd(ss, id, request->fd, request->opaque, 0);
+	// the fd may be blocking , so read it once for each event
+	s->edge = 0;
+	if (sp_add(ss->event_fd, s->fd, s, 0)) {
+		s->type = SOCKET_TYPE_INVALID;
+		result->data = NULL;
+		return SOCKET_ERROR;
+	}
+	s->reading = 1;
+	s->type = SOCKET_TYPE_BIND;
+	result->data = "binding";
+	return SOCKET_OPEN;
+}
+
+static int
+start_socket(struct socket_server *ss, struct request_start *request, struct socket_message *result) {
+	int id = request->id;
+	result->id = id;
+	result->opaque = request->opaque;
+	result->ud = 0;
+	result->data = NULL;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (s->type == SOCKET_TYPE_INVALID || s->id != id) {
+		return SOCKET_ERROR;
+	}
+	if (s->type == SOCKET_TYPE_PACCEPT || s->type == SOCKET_TYPE_PLISTEN) {
+		if (sp_add(ss->event_fd, s->fd, s, s->edge)) {
+			s->type = SOCKET_TYPE_INVALID;
+			close(s->fd);
+			return SOCKET_ERROR;
+		}
+		s->type = (s->type == SOCKET_TYPE_PACCEPT) ? SOCKET_TYPE_CONNECTED : SOCKET_TYPE_LISTEN;
+		s->opaque = request->opaque;
+		s->reading = 1;
+		result->data = "start";
+		return SOCKET_OPEN;
+	}
+	if ((s->type == SOCKET_TYPE_CONNECTED || s->type == SOCKET_TYPE_BIND) && !s->reading) {
+		s->opaque = request->opaque;
+		s->reading = 1;
+		sp_set(ss->event_fd, s->fd, s, 1, s->head != NULL, s->edge);
+	}
+	return -1;
+}
+
+static void
+pause_socket(struct socket_server *ss, struct request_start *request) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (s->type == SOCKET_TYPE_INVALID || s->id != id) {
+		return;
+	}
+	if ((s->type == SOCKET_TYPE_CONNECTED || s->type == SOCKET_TYPE_BIND) && s->reading) {
+		s->reading = 0;
+		sp_set(ss->event_fd, s->fd, s, 0, s->head != NULL, s->edge);
+	}
+}
+
+static void
+setopt_socket(struct socket_server *ss, struct request_setopt *request) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (s->type == SOCKET_TYPE_INVALID || s->id != id) {
+		return;
+	}
+	switch (request->what) {
+	case SOCKET_OPT_CORK:
+		s->cork = request->value;
+		break;
+	case SOCKET_OPT_LIMIT:
+		s->limit = request->value;
+		break;
+	}
+}
+
+static void
+block_readpipe(int pipefd, void *buffer, int sz) {
+	for (;;) {
+		int n = read(pipefd, buffer, sz);
+		if (n<0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			fprintf(stderr, "socket-server : read pipe error %s.\n",strerror(errno));
+			return;
+		}
+		// must be atomic write
+		assert(n == sz);
+		return;
+	}
+}
+
+// return -2 when the pipe is empty , -1 for nothing to report , or the type of result
+static int
+ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
+	int fd = ss->recvctrl_fd;
+	uint8_t header[2];
+	struct request_package request;
+	int n = read(fd, header, sizeof(header));
+	if (n < 0) {
+		return errno == EINTR ? -1 : -2;
+	}
+	if (n == 0) {
+		return -2;
+	}
+	if (n != sizeof(header)) {
+		block_readpipe(fd, header + n, sizeof(header) - n);
+	}
+	int type = header[0];
+	int len = header[1];
+	block_readpipe(fd, request.u.buffer, len);
+	switch (type) {
+	case 'S':
+		return start_socket(ss, &request.u.start, result);
+	case 'P':
+		pause_socket(ss, &request.u.start);
+		return -1;
+	case 'T':
+		setopt_socket(ss, &request.u.setopt);
+		return -1;
+	case 'B':
+		return bind_socket(ss, &request.u.bind, result);
+	case 'L':
+		return listen_socket(ss, &request.u.listen, result);
+	case 'K':
+		return close_socket(ss, &request.u.close, result);
+	case 'O':
+		return open_socket(ss, &request.u.open, result);
+	case 'X':
+		result->opaque = 0;
+		result->id = 0;
+		result->ud = 0;
+		result->data = NULL;
+		return SOCKET_EXIT;
+	case 'D':
+		return send_socket(ss, &request.u.send, result);
+	default:
+		fprintf(stderr, "socket-server: Unknown ctrl %c.\n",type);
+		return -1;
+	};
+
+	return -1;
+}
+
+// the fd of a bound socket belongs to its owner , keep it open until the owner closes the socket
+static void
+close_read(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	if (s->type != SOCKET_TYPE_BIND) {
+		force_close(ss, s, result);
+		return;
+	}
+	result->id = s->id;
+	result->ud = 0;
+	result->data = NULL;
+	result->opaque = s->opaque;
+	sp_del(ss->event_fd, s->fd);
+	s->reading = 0;
+	s->type = SOCKET_TYPE_BINDCLOSE;
+}
+
+// return -1 (ignore) when error
+static int
+forward_message(struct socket_server *ss, struct socket *s, struct socket_message * result) {
+	int sz = s->size;
+	char * buffer = skynet_malloc(sz);
+	int n = (int)read(s->fd, buffer, sz);
+	if (n<0) {
+		skynet_free(buffer);
+		switch(errno) {
+		case EINTR:
+		case EAGAIN:
+			break;
+		default:
+			close_read(ss, s, result);
+			return SOCKET_ERROR;
+		}
+		return -1;
+	}
+	if (n==0) {
+		skynet_free(buffer);
+		close_read(ss, s, result);
+		return SOCKET_CLOSE;
+	}
+
+	if (s->type == SOCKET_TYPE_HALFCLOSE) {
+		// discard recv data
+		skynet_free(buffer);
+		return -1;
+	}
+
+	if (n == sz) {
+		s->size *= 2;
+	} else if (sz > MIN_READ_BUFFER && n*2 < sz) {
+		s->size /= 2;
+	}
+
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->ud = n;
+	result->data = buffer;
+	return SOCKET_DATA;
+}
+
+static int
+report_connect(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	int error;
+	socklen_t len = sizeof(error);
+	int code = getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+	if (code < 0 || error) {
+		force_close(ss,s, result);
+		return SOCKET_ERROR;
+	}
+	s->type = SOCKET_TYPE_CONNECTED;
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->ud = 0;
+	result->data = NULL;
+	sp_set(ss->event_fd, s->fd, s, s->reading, s->head != NULL, s->edge);
+	return SOCKET_OPEN;
+}
+
+// return 0 when there is nothing to accept (or it can't accept now) , -1 when the connection is dropped
+static int
+report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	union {
+		struct sockaddr s;
+		struct sockaddr_in v4;
+		struct sockaddr_in6 v6;
+	} u;
+	socklen_t len = sizeof(u);
+#ifdef __linux__
+	int client_fd = accept4(s->fd, &u.s, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	int client_fd = accept(s->fd, &u.s, &len);
+#endif
+	if (client_fd < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) {
+			// try the next one
+			return -1;
+		}
+		// EMFILE , ENFILE , ENOBUFS , ENOMEM ... The listener would be ready (level trigger) or never
+		// triggered again (edge trigger) , so stop it until a socket is closed or ACCEPT_RETRY passed.
+		if (errno != ss->accept_error) {
+			ss->accept_error = errno;
+			fprintf(stderr, "socket-server: accept error %s , retry later.\n", strerror(errno));
+		}
+		s->reading = 0;
+		sp_set(ss->event_fd, s->fd, s, 0, 0, s->edge);
+		s->next_stopped = ss->stopped;
+		ss->stopped = s;
+		return 0;
+	}
+	ss->accept_error = 0;
+	int id = reserve_id(ss);
+	if (id < 0) {
+		close(client_fd);
+		return -1;
+	}
+	int keepalive = 1;
+	setsockopt(client_fd, SOL_SOCKET, SO_KEEPALIVE, (void *)&keepalive , sizeof(keepalive));
+	// packages are small and written at once , don't wait for the ack of last one
+	int nodelay = 1;
+	setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (void *)&nodelay , sizeof(nodelay));
+#ifndef __linux__
+	sp_nonblocking(client_fd);
+#endif
+	struct socket *ns = new_fd(ss, id, client_fd, s->opaque, 0);
+	if (ns == NULL) {
+		close(client_fd);
+		return -1;
+	}
+	ns->type = SOCKET_TYPE_PACCEPT;
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->ud = id;
+	result->data = NULL;
+
+	char tmp[INET6_ADDRSTRLEN];
+	void * sin_addr = (u.s.sa_family == AF_INET) ? (void*)&u.v4.sin_addr : (void *)&u.v6.sin6_addr;
+	int sin_port = ntohs((u.s.sa_family == AF_INET) ? u.v4.sin_port : u.v6.sin6_port);
+	if (inet_ntop(u.s.sa_family, sin_addr, tmp, sizeof(tmp))) {
+		snprintf(ss->info, sizeof(ss->info), "%s:%d", tmp, sin_port);
+		result->data = ss->info;
+	}
+
+	return 1;
+}
+
+// the events of a socket closed by a request are out of date , the slot may be reused
+static void
+clear_closed_event(struct socket_server *ss, struct socket_message * result, int type) {
+	if (type == SOCKET_CLOSE || type == SOCKET_ERROR) {
+		struct socket * s = &ss->slot[HASH_ID(result->id)];
+		int i;
+		for (i=ss->event_index; i<ss->event_n; i++) {
+			struct event *e = &ss->ev[i];
+			if (e->s == s) {
+				e->read = e->write = 0;
+			}
+		}
+	}
+}
+
+int
+socket_server_poll(struct socket_server *ss, struct socket_message * result, int * more) {
+	for (;;) {
+		if (ss->checkctrl) {
+			int type = ctrl_cmd(ss, result);
+			if (type == -2) {
+				ss->checkctrl = 0;
+				flush_corked(ss);
+			} else if (type != -1) {
+				clear_closed_event(ss, result, type);
+				return type;
+			}
+			continue;
+		}
+		if (ss->event_index == ss->event_n) {
+			ss->event_n = sp_wait(ss->event_fd, ss->ev, ss->event_max, ss->stopped ? ACCEPT_RETRY : -1);
+			if (ss->stopped) {
+				// the fd may be released out of socket server
+				resume_listen(ss);
+			}
+			if (more) {
+				*more = 0;
+			}
+			ss->event_index = 0;
+			if (ss->event_n <= 0) {
+				ss->event_n = 0;
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+		}
+		struct event *e = &ss->ev[ss->event_index++];
+		struct socket *s = e->s;
+		if (s == NULL) {
+			// command pipe
+			ss->checkctrl = 1;
+			continue;
+		}
+		if (!e->read && !e->write) {
+			continue;
+		}
+		switch (s->type) {
+		case SOCKET_TYPE_CONNECTING:
+			return report_connect(ss, s, result);
+		case SOCKET_TYPE_LISTEN: {
+			if (!s->reading) {
+				// stopped by accept error in this wait
+				break;
+			}
+			int ok = report_accept(ss, s, result);
+			if (ok == 0) {
+				break;
+			}
+			// accept again until EAGAIN , edge trigger needs it , and a burst of connections is taken in one wait
+			--ss->event_index;
+			if (ok > 0) {
+				return SOCKET_ACCEPT;
+			}
+			break;
+		}
+		case SOCKET_TYPE_INVALID:
+			fprintf(stderr, "socket-server: invalid socket\n");
+			break;
+		default:
+			if (e->read) {
+				int sz = s->size;
+				int type = forward_message(ss, s, result);
+				if (type == SOCKET_DATA && s->edge && s->reading && result->ud == sz) {
+					// edge triggered , read again until the kernel buffer is drained
+					--ss->event_index;
+				} else if (e->write && type != SOCKET_CLOSE && type != SOCKET_ERROR) {
+					// handle the write event next time
+					e->read = 0;
+					--ss->event_index;
+				}
+				if (type == -1)
+					break;
+				clear_closed_event(ss, result, type);
+				return type;
+			}
+			if (e->write) {
+				int type = send_buffer(ss, s, result);
+				if (type == -1)
+					break;
+				clear_closed_event(ss, result, type);
+				return type;
+			}
+			break;
+		}
+	}
+}
+
+static void
+send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
+	request->header[6] = (uint8_t)type;
+	request->header[7] = (uint8_t)len;
+	for (;;) {
+		int n = write(ss->sendctrl_fd, &request->header[6], len+2);
+		if (n<0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "socket-server : send ctrl command error %s.\n", strerror(errno));
+			return;
+		}
+		assert(n == len+2);
+		return;
+	}
+}
+
+int
+socket_server_connect(struct socket_server *ss, uintptr_t opaque, const char * addr, int port) {
+	struct request_package request;
+	int len = strlen(addr);
+	if (len + sizeof(request.u.open) > 256) {
+		fprintf(stderr, "socket-server : Invalid addr %s.\n",addr);
+		return -1;
+	}
+	int id = reserve_id(ss);
+	if (id < 0) {
+		return -1;
+	}
+	request.u.open.opaque = opaque;
+	request.u.open.id = id;
+	request.u.open.port = port;
+	memcpy(request.u.open.host, addr, len);
+	request.u.open.host[len] = '\0';
+	send_request(ss, &request, 'O', sizeof(request.u.open) + len);
+	return id;
+}
+
+int
+socket_server_send(struct socket_server *ss, int id, void * buffer, int sz) {
+	return socket_server_send_slice(ss, id, buffer, 0, sz);
+}
+
+int 
+socket_server_send_slice(struct socket_server *ss, int id, void * buffer, int offset, int sz) {
+	struct socket * s = &ss->slot[HASH_ID(id)];
+	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
+		skynet_free(buffer);
+		return -1;
+	}
+
+	struct request_package request;
+	request.u.send.id = id;
+	request.u.send.sz = sz;
+	request.u.send.offset = offset;
+	request.u.send.buffer = (char *)buffer;
+
+	send_request(ss, &request, 'D', sizeof(request.u.send));
+	return 0;
+}
+
+void
+socket_server_exit(struct socket_server *ss) {
+	struct request_package request;
+	send_request(ss, &request, 'X', 0);
+}
+
+void
+socket_server_close(struct socket_server *ss, uintptr_t opaque, int id) {
+	struct request_package request;
+	request.u.close.id = id;
+	request.u.close.opaque = opaque;
+	send_request(ss, &request, 'K', sizeof(request.u.close));
+}
+
+static int
+do_listen(const char * host, int port, int backlog, int reuseport) {
+	uint32_t addr = INADDR_ANY;
+	if (host && host[0]) {
+		addr = inet_addr(host);
+	}
+	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		return -1;
+	}
+	int reuse = 1;
+	if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, (void *)&reuse, sizeof(int))==-1) {
+		goto _failed;
+	}
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		// the kernel spreads the connections among the sockets listening on the same port
+		if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, (void *)&reuse, sizeof(int))==-1) {
+			goto _failed;
+		}
+#else
+		goto _failed;
+#endif
+	}
+
+	struct sockaddr_in my_addr;
+	memset(&my_addr, 0, sizeof(struct sockaddr_in));
+	my_addr.sin_family = AF_INET;
+	my_addr.sin_port = htons(port);
+	my_addr.sin_addr.s_addr = addr;
+	if (bind(listen_fd, (struct sockaddr *)&my_addr, sizeof(struct sockaddr)) == -1) {
+		goto _failed;
+	}
+	if (listen(listen_fd, backlog) == -1) {
+		goto _failed;
+	}
+	sp_nonblocking(listen_fd);
+	return listen_fd;
+_failed:
+	close(listen_fd);
+	return -1;
+}
+
+int
+socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog, int reuseport) {
+	int fd = do_listen(addr, port, backlog, reuseport);
+	if (fd < 0) {
+		return -1;
+	}
+	struct request_package request;
+	int id = reserve_id(ss);
+	if (id < 0) {
+		close(fd);
+		return -1;
+	}
+	request.u.listen.opaque = opaque;
+	request.u.listen.id = id;
+	request.u.listen.fd = fd;
+	send_request(ss, &request, 'L', sizeof(request.u.listen));
+	return id;
+}
+
+int
+socket_server_bind(struct socket_server *ss, uintptr_t opaque, int fd) {
+	struct request_package request;
+	int id = reserve_id(ss);
+	if (id < 0) {
+		return -1;
+	}
+	request.u.bind.opaque = opaque;
+	request.u.bind.id = id;
+	request.u.bind.fd = fd;
+	send_request(ss, &request, 'B', sizeof(request.u.bind));
+	return id;
+}
+
+void
+socket_server_start(struct socket_server *ss, uintptr_t opaque, int id) {
+	struct request_package request;
+	request.u.start.id = id;
+	request.u.start.opaque = opaque;
+	send_request(ss, &request, 'S', sizeof(request.u.start));
+}
+
+void
+socket_server_pause(struct socket_server *ss, uintptr_t opaque, int id) {
+	struct request_package request;
+	request.u.start.id = id;
+	request.u.start.opaque = opaque;
+	send_request(ss, &request, 'P', sizeof(request.u.start));
+}
+
+static void
+setopt(struct socket_server *ss, int id, int what, int value) {
+	struct request_package request;
+	request.u.setopt.id = id;
+	request.u.setopt.what = what;
+	request.u.setopt.value = value;
+	send_request(ss, &request, 'T', sizeof(request.u.setopt));
+}
+
+void
+socket_server_cork(struct socket_server *ss, int id, int on) {
+	setopt(ss, id, SOCKET_OPT_CORK, on);
+}
+
+void
+socket_server_limit(struct socket_server *ss, int id, int limit) {
+	setopt(ss, id, SOCKET_OPT_LIMIT, limit);
+}
@@ -0,0 +1,59 @@
+#ifndef SKYNET_SOCKET_SERVER_H
+#define SKYNET_SOCKET_SERVER_H
+
+#include <stdint.h>
+
+// type returned by socket_server_poll
+#define SOCKET_DATA 0
+#define SOCKET_CLOSE 1
+#define SOCKET_OPEN 2
+#define SOCKET_ACCEPT 3
+#define SOCKET_ERROR 4
+#define SOCKET_EXIT 5
+
+struct socket_server;
+
+struct socket_message {
+	int id;
+	uintptr_t opaque;	// the owner of the socket
+	int ud;	// size of data for SOCKET_DATA , id of new socket for SOCKET_ACCEPT
+	char * data;	// allocated by skynet_malloc for SOCKET_DATA , or a string owned by socket server
+};
+
+// event is the max number of events got by one wait , edge is 1 for edge triggered sockets
+struct socket_server * socket_server_create(int event, int edge);
+void socket_server_release(struct socket_server *);
+// run in the socket thread only , return one of the types above , or -1 for nothing to report.
+// *more is set to 0 when the events of last wait are all handled
+int socket_server_poll(struct socket_server *, struct socket_message *result, int *more);
+
+// Functions below can be called from any thread , they send a request to the socket thread
+// by the command pipe , and the result is reported by socket_server_poll to opaque.
+
+void socket_server_exit(struct socket_server *);
+// close after the pending data is written
+void socket_server_close(struct socket_server *, uintptr_t opaque, int id);
+// start to read a listened or accepted socket , or resume a paused one , opaque becomes the owner
+void socket_server_start(struct socket_server *, uintptr_t opaque, int id);
+// stop reading the socket , tcp flow control slows down the peer
+void socket_server_pause(struct socket_server *, uintptr_t opaque, int id);
+
+// a corked socket doesn't write at once , the packages sent before the socket thread wakes up are
+// written together by writev
+void socket_server_cork(struct socket_server *, int id, int on);
+// the socket is closed (reported as SOCKET_ERROR) when more than limit bytes wait to be sent , 0 for no limit
+void socket_server_limit(struct socket_server *, int id, int limit);
+
+// buffer is allocated by skynet_malloc , and freed by socket server. return -1 if id is invalid
+int socket_server_send(struct socket_server *, int id, void * buffer, int sz);
+// send sz bytes at buffer+offset , buffer is freed by socket server as above
+int socket_server_send_slice(struct socket_server *, int id, void * buffer, int offset, int sz);
+
+// return socket id , or -1 for error. listen and bind are done in the caller , so the error is known at once
+// reuseport (SO_REUSEPORT) lets many sockets listen on the same port , each gets a share of the connections
+int socket_server_listen(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog, int reuseport);
+int socket_server_connect(struct socket_server *, uintptr_t opaque, const char * addr, int port);
+// poll an opened fd (stdin for example) , it's not turned to nonblocking
+int socket_server_bind(struct socket_server *, uintptr_t opaque, int fd);
+
+#endif